@@ -0,0 +1,90 @@
+// Measures the dispatch overhead of the job system: the cost per job of
+// running empty jobs through run/wait and parallelFor, against calling the
+// same functions directly on one thread.
+//
+// make bench && ./jobsystem_benchmark [numJobs] [numWorkers]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+#include "../src/JobSystem/JobSystem.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double nanosecondsPerJob(Clock::time_point start, Clock::time_point end, int numJobs) {
+	return std::chrono::duration<double, std::nano>(end - start).count() / numJobs;
+}
+
+int main(int argc, char* argv[]) {
+	const int numJobs = argc > 1 ? std::atoi(argv[1]) : 1000000;
+	const int numWorkers = argc > 2 ? std::atoi(argv[2]) : 0;
+	const int numRepeats = 5;
+
+	JobSystem jobSystem(numWorkers);
+	std::atomic<int> sink{0};
+
+	printf("%d jobs on %d threads, best of %d runs\n", numJobs, jobSystem.getNumThreads(), numRepeats);
+
+	double best = 1e30;
+	for (int repeat = 0; repeat < numRepeats; repeat++) {
+		std::function<void()> function = [&sink]() { sink.fetch_add(1, std::memory_order_relaxed); };
+		auto start = Clock::now();
+		for (int i = 0; i < numJobs; i++) {
+			function();
+		}
+		best = std::min(best, nanosecondsPerJob(start, Clock::now(), numJobs));
+	}
+	printf("  direct std::function call: %8.1f ns/job\n", best);
+
+	best = 1e30;
+	for (int repeat = 0; repeat < numRepeats; repeat++) {
+		JobCounter counter;
+		auto start = Clock::now();
+		for (int i = 0; i < numJobs; i++) {
+			jobSystem.run([&sink]() { sink.fetch_add(1, std::memory_order_relaxed); }, &counter);
+		}
+		jobSystem.wait(counter);
+		best = std::min(best, nanosecondsPerJob(start, Clock::now(), numJobs));
+	}
+	printf("  run + wait:                %8.1f ns/job\n", best);
+
+	best = 1e30;
+	for (int repeat = 0; repeat < numRepeats; repeat++) {
+		JobCounter parent;
+		auto start = Clock::now();
+		const int numChildren = 64;
+		for (int child = 0; child < numChildren; child++) {
+			jobSystem.run([&jobSystem, &parent, &sink, numJobs, numChildren]() {
+				// Each job fans out its share of the jobs on a child counter
+				JobCounter children(&parent);
+				for (int i = 0; i < numJobs / numChildren; i++) {
+					jobSystem.run([&sink]() { sink.fetch_add(1, std::memory_order_relaxed); }, &children);
+				}
+				jobSystem.wait(children);
+			}, &parent);
+		}
+		jobSystem.wait(parent);
+		best = std::min(best, nanosecondsPerJob(start, Clock::now(), numJobs));
+	}
+	printf("  nested run + wait:         %8.1f ns/job\n", best);
+
+	// parallelFor splits the range in a few chunks per thread, each chunk is a job
+	best = 1e30;
+	int numChunks = 0;
+	for (int repeat = 0; repeat < numRepeats; repeat++) {
+		std::atomic<int> numCalls{0};
+		auto start = Clock::now();
+		jobSystem.parallelFor(0, numJobs, [&sink, &numCalls](int begin, int end) {
+			sink.fetch_add(end - begin, std::memory_order_relaxed);
+			numCalls.fetch_add(1, std::memory_order_relaxed);
+		}, 1);
+		const auto end = Clock::now();
+		numChunks = numCalls.load();
+		best = std::min(best, nanosecondsPerJob(start, end, numChunks));
+	}
+	printf("  parallelFor, %d chunks:    %8.1f ns/job\n", numChunks, best);
+
+	return sink.load() > 0 ? 0 : 1;
+}
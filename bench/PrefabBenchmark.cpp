@@ -0,0 +1,66 @@
+// Measures spawning entities with a transform, a rigid body and a box collider,
+// as the projectile emitters do: Registry::instantiate from a prefab against
+// createEntity and one addComponent per component. Every run starts from an
+// empty registry.
+//
+// make bench && ./prefab_benchmark [numEntities]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include "../src/ECS/ECS.h"
+#include "../src/Components/TransformComponent.h"
+#include "../src/Components/RigidBodyComponent.h"
+#include "../src/Components/BoxColliderComponent.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+template <typename TSpawn> static double measure(int numRepeats, TSpawn spawn) {
+	double best = 1e30;
+	for (int repeat = 0; repeat < numRepeats; repeat++) {
+		Registry registry;
+		auto start = Clock::now();
+		spawn(registry);
+		registry.update();
+		best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+	}
+
+	return best;
+}
+
+int main(int argc, char* argv[]) {
+	const int numEntities = argc > 1 ? std::atoi(argv[1]) : 5000;
+	const int numRepeats = 10;
+
+	printf("%d entities with 3 components, best of %d runs\n", numEntities, numRepeats);
+
+	// The registry logs every entity created one by one, which is part of the
+	// cost being measured but would flood the output
+	std::cout.setstate(std::ios::failbit);
+
+	double best = measure(numRepeats, [numEntities](Registry& registry) {
+		for (int i = 0; i < numEntities; i++) {
+			Entity entity = registry.createEntity();
+			entity.addComponent<TransformComponent>(glm::vec2(0, 0), glm::vec2(1.0, 1.0), 0);
+			entity.addComponent<RigidBodyComponent>();
+			entity.addComponent<BoxColliderComponent>(4, 4);
+		}
+	});
+
+	std::cout.clear();
+	printf("  createEntity + addComponent: %8.3f ms\n", best);
+
+	best = measure(numRepeats, [numEntities](Registry& registry) {
+		Prefab& prefab = registry.createPrefab("bullet")
+			.addComponent<TransformComponent>(glm::vec2(0, 0), glm::vec2(1.0, 1.0), 0)
+			.addComponent<RigidBodyComponent>()
+			.addComponent<BoxColliderComponent>(4, 4);
+
+		registry.instantiate(prefab, numEntities);
+	});
+	printf("  instantiate:                 %8.3f ms\n", best);
+
+	return 0;
+}
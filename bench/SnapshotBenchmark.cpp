@@ -0,0 +1,152 @@
+// Measures saving and loading registry snapshots of entities with a transform
+// and a rigid body, as F5 and F9 do in the game. Every run saves a registry
+// whose components were all written since the last save, so no page can share
+// a piece of the previous snapshot, and loads it back from its file bytes, so
+// every pool is loaded.
+//
+// Then measures a rollback as F6 does in the game: saving every frame into the
+// ring, restoring the frame 8 frames back and simulating the 8 frames again.
+// Once with every entity moving, where every page of the transforms is saved
+// each frame, and once with a mostly static world where only a tenth of the
+// entities move, packed at the front of an owning group, so the pages of the
+// static transforms are shared between the frames.
+//
+// make bench && ./snapshot_benchmark [numEntities]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include "../src/ECS/ECS.h"
+#include "../src/Components/TransformComponent.h"
+#include "../src/Components/RigidBodyComponent.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double millisecondsSince(Clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void move(Entity, TransformComponent& transform, const RigidBodyComponent& rigidBody) {
+	transform.position += rigidBody.velocity * 0.016f;
+}
+
+static const int NUM_REPEATS = 10;
+static const int NUM_REWOUND_FRAMES = 8;
+
+struct RollbackTimes {
+	double frameSave = 1e30;
+	double rollback = 1e30;
+};
+
+// Fills a ring of 60 frames, then saves one more frame and rolls it back,
+// keeping the best times. moveEntities runs the systems of a frame.
+template <typename TFunction> static RollbackTimes measureRollback(Registry& registry, TFunction&& moveEntities) {
+	RollbackBuffer rollbackBuffer(60);
+	RollbackTimes times;
+	int frame = 0;
+
+	auto simulateFrame = [&registry, &rollbackBuffer, &moveEntities](int frame) {
+		registry.update();
+		rollbackBuffer.save(registry, frame);
+		moveEntities();
+	};
+
+	for (; frame < 60; frame++) {
+		simulateFrame(frame);
+	}
+
+	for (int repeat = 0; repeat < NUM_REPEATS; repeat++) {
+		registry.update();
+		auto start = Clock::now();
+		rollbackBuffer.save(registry, frame);
+		times.frameSave = std::min(times.frameSave, millisecondsSince(start));
+		moveEntities();
+		frame++;
+
+		start = Clock::now();
+		const int restoredFrame = frame - NUM_REWOUND_FRAMES;
+		rollbackBuffer.restore(registry, restoredFrame);
+		moveEntities();
+		for (int resimulatedFrame = restoredFrame + 1; resimulatedFrame < frame; resimulatedFrame++) {
+			simulateFrame(resimulatedFrame);
+		}
+		times.rollback = std::min(times.rollback, millisecondsSince(start));
+	}
+
+	return times;
+}
+
+int main(int argc, char* argv[]) {
+	const int numEntities = argc > 1 ? std::atoi(argv[1]) : 100000;
+
+	// The registry logs every created entity and every loaded snapshot
+	std::cout.setstate(std::ios::failbit);
+
+	Registry registry;
+	for (int i = 0; i < numEntities; i++) {
+		Entity entity = registry.createEntity();
+		entity.addComponent<TransformComponent>(glm::vec2(i, i));
+		entity.addComponent<RigidBodyComponent>(glm::vec2(1, 2));
+	}
+	registry.update();
+
+	double bestSave = 1e30;
+	double bestLoad = 1e30;
+	size_t snapshotSize = 0;
+
+	for (int repeat = 0; repeat < NUM_REPEATS; repeat++) {
+		registry.update();
+		// The mutable rigid bodies are stamped too
+		registry.view<TransformComponent, RigidBodyComponent>().each(move);
+
+		RegistrySnapshot snapshot;
+		auto start = Clock::now();
+		registry.saveSnapshot(snapshot);
+		bestSave = std::min(bestSave, millisecondsSince(start));
+
+		auto bytes = std::make_shared<std::vector<unsigned char>>();
+		snapshot.write(*bytes);
+		snapshotSize = bytes->size();
+
+		RegistrySnapshot savedSnapshot;
+		savedSnapshot.read(bytes);
+
+		start = Clock::now();
+		registry.loadSnapshot(savedSnapshot);
+		bestLoad = std::min(bestLoad, millisecondsSince(start));
+	}
+
+	const RollbackTimes allMoving = measureRollback(registry, [&registry]() {
+		registry.view<TransformComponent, const RigidBodyComponent>().each(move);
+	});
+
+	Registry staticRegistry;
+	const int numMovingEntities = numEntities / 10;
+	for (int i = 0; i < numEntities; i++) {
+		Entity entity = staticRegistry.createEntity();
+		entity.addComponent<TransformComponent>(glm::vec2(i, i));
+		if (i % 10 == 0) {
+			entity.addComponent<RigidBodyComponent>(glm::vec2(1, 2));
+		}
+	}
+	auto movingEntities = staticRegistry.owningGroup<TransformComponent, const RigidBodyComponent>();
+	staticRegistry.update();
+
+	const RollbackTimes mostlyStatic = measureRollback(staticRegistry, [&movingEntities]() {
+		movingEntities.each(move);
+	});
+
+	std::cout.clear();
+	printf("%d entities with 2 components, %zu bytes, best of %d runs\n", numEntities, snapshotSize, NUM_REPEATS);
+	printf("  save:                               %8.3f ms\n", bestSave);
+	printf("  load:                               %8.3f ms\n", bestLoad);
+	printf("  save frame into the ring:           %8.3f ms\n", allMoving.frameSave);
+	printf("  restore + %d re-simulated frames:    %8.3f ms\n", NUM_REWOUND_FRAMES, allMoving.rollback);
+	printf("%d entities with a transform, %d of them moving\n", numEntities, numMovingEntities);
+	printf("  save frame into the ring:           %8.3f ms\n", mostlyStatic.frameSave);
+	printf("  restore + %d re-simulated frames:    %8.3f ms\n", NUM_REWOUND_FRAMES, mostlyStatic.rollback);
+
+	return 0;
+}
@@ -0,0 +1,95 @@
+// Measures the movement update of MovementSystem over Transform and RigidBody
+// components: a serial each() against parallelEach() on the job system, over
+// a view and over the owning group the system uses, and over a view of the
+// archetype storage. Two thirds of the entities have a velocity, so the sparse
+// set view has to skip the others.
+//
+// make bench && ./view_benchmark [numEntities] [numWorkers]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include "../src/ECS/ECS.h"
+#include "../src/Components/TransformComponent.h"
+#include "../src/Components/RigidBodyComponent.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static void move(Entity, TransformComponent& transform, const RigidBodyComponent& rigidBody) {
+	transform.position += rigidBody.velocity * 0.016f;
+}
+
+template <typename TUpdate> static double measure(int numRepeats, TUpdate update) {
+	double best = 1e30;
+	for (int repeat = 0; repeat < numRepeats; repeat++) {
+		auto start = Clock::now();
+		update();
+		best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+	}
+
+	return best;
+}
+
+static int createEntities(Registry& registry, int numEntities) {
+	int numMoving = 0;
+	for (int i = 0; i < numEntities; i++) {
+		Entity entity = registry.createEntity();
+		entity.addComponent<TransformComponent>(glm::vec2(i, 0));
+		if (i % 3) {
+			entity.addComponent<RigidBodyComponent>(glm::vec2(1, 2));
+			numMoving++;
+		}
+	}
+	registry.update();
+
+	return numMoving;
+}
+
+int main(int argc, char* argv[]) {
+	const int numEntities = argc > 1 ? std::atoi(argv[1]) : 200000;
+	const int numWorkers = argc > 2 ? std::atoi(argv[2]) : 0;
+	const int numRepeats = 20;
+
+	// The registry logs every created entity
+	std::cout.setstate(std::ios::failbit);
+
+	JobSystem jobSystem(numWorkers);
+	Registry registry;
+	Registry archetypeRegistry(ARCHETYPE_STORAGE);
+	registry.setJobSystem(&jobSystem);
+	archetypeRegistry.setJobSystem(&jobSystem);
+
+	const int numMoving = createEntities(registry, numEntities);
+	createEntities(archetypeRegistry, numEntities);
+
+	std::cout.clear();
+	printf("%d entities, %d moving, on %d threads, best of %d runs\n", numEntities, numMoving, jobSystem.getNumThreads(), numRepeats);
+
+	auto view = registry.view<TransformComponent, const RigidBodyComponent>();
+
+	double best = measure(numRepeats, [&view]() { view.each(move); });
+	printf("  view each:              %8.3f ms\n", best);
+
+	best = measure(numRepeats, [&view]() { view.parallelEach(move); });
+	printf("  view parallelEach:      %8.3f ms\n", best);
+
+	auto group = registry.owningGroup<TransformComponent, const RigidBodyComponent>();
+
+	best = measure(numRepeats, [&group]() { group.each(move); });
+	printf("  group each:             %8.3f ms\n", best);
+
+	best = measure(numRepeats, [&group]() { group.parallelEach(move); });
+	printf("  group parallelEach:     %8.3f ms\n", best);
+
+	auto archetypeView = archetypeRegistry.view<TransformComponent, const RigidBodyComponent>();
+
+	best = measure(numRepeats, [&archetypeView]() { archetypeView.each(move); });
+	printf("  archetype each:         %8.3f ms\n", best);
+
+	best = measure(numRepeats, [&archetypeView]() { archetypeView.parallelEach(move); });
+	printf("  archetype parallelEach: %8.3f ms\n", best);
+
+	return 0;
+}
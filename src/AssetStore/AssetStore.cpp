@@ -5,11 +5,16 @@
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_ttf.h>
 
-AssetStore::AssetStore() {
+AssetStore::AssetStore(JobSystem* jobSystem): jobSystem(jobSystem) {
 	Logger::info("AssetStore constructor called");
 }
 
 AssetStore::~AssetStore() {
+	// The decoding jobs write into this store
+	if (jobSystem) {
+		jobSystem->wait(decodingJobs, JOB_LOW_PRIORITY);
+	}
+
 	clearAssets();
 	Logger::info("AssetStore destructor called");
 }
@@ -24,6 +29,14 @@ void AssetStore::clearAssets() {
 		TTF_CloseFont(font.second);
 	}
 
+	{
+		std::lock_guard<std::mutex> lock(decodedImagesMutex);
+		for (auto& decodedImage: decodedImages) {
+			SDL_FreeSurface(decodedImage.surface);
+		}
+		decodedImages.clear();
+	}
+
 	textures.clear();
 	fonts.clear();
 }
@@ -36,6 +49,42 @@ void AssetStore::addTexture(SDL_Renderer* renderer, const std::string& assetId,
 	Logger::info("New texture added to AssetStore with id " + assetId);
 }
 
+void AssetStore::addTextureAsync(const std::string& assetId, const std::string& filePath) {
+	auto decode = [this, assetId, filePath]() {
+		SDL_Surface* surface = IMG_Load(filePath.c_str());
+		std::lock_guard<std::mutex> lock(decodedImagesMutex);
+		decodedImages.push_back(DecodedImage{assetId, surface});
+	};
+
+	if (jobSystem) {
+		jobSystem->run(decode, &decodingJobs, JOB_LOW_PRIORITY);
+	} else {
+		decode();
+	}
+}
+
+void AssetStore::uploadDecodedTextures(SDL_Renderer* renderer) {
+	std::vector<DecodedImage> images;
+	{
+		std::lock_guard<std::mutex> lock(decodedImagesMutex);
+		images.swap(decodedImages);
+	}
+
+	for (auto& image: images) {
+		SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, image.surface);
+		SDL_FreeSurface(image.surface);
+		textures[image.assetId] = texture;
+		Logger::info("New texture added to AssetStore with id " + image.assetId);
+	}
+}
+
+void AssetStore::waitForTextures(SDL_Renderer* renderer) {
+	if (jobSystem) {
+		jobSystem->wait(decodingJobs, JOB_LOW_PRIORITY);
+	}
+	uploadDecodedTextures(renderer);
+}
+
 SDL_Texture* AssetStore::getTexture(const std::string& assetId) {
 	return textures[assetId];
 }
@@ -3,22 +3,45 @@
 
 #include <unordered_map>
 #include <string>
+#include <vector>
+#include <mutex>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 
+#include "../JobSystem/JobSystem.h"
+
 class AssetStore {
 
 private:
 	std::unordered_map<std::string, SDL_Texture*> textures;
 	std::unordered_map<std::string, TTF_Font*> fonts;
 
+	// Images decoded by background jobs, waiting to be turned into textures on
+	// the render thread
+	struct DecodedImage {
+		std::string assetId;
+		SDL_Surface* surface;
+	};
+
+	JobSystem* jobSystem;
+	JobCounter decodingJobs;
+	std::vector<DecodedImage> decodedImages;
+	std::mutex decodedImagesMutex;
+
 public:
-	AssetStore();
+	// Without a job system the asynchronous loads decode on the calling thread
+	AssetStore(JobSystem* jobSystem = nullptr);
 	~AssetStore();
 	
 	void clearAssets();
 
 	void addTexture(SDL_Renderer* renderer, const std::string& assetId, const std::string& filePath);
+
+	// Decodes the image in a low priority job. The texture is available after
+	// the next uploadDecodedTextures or waitForTextures on the render thread
+	void addTextureAsync(const std::string& assetId, const std::string& filePath);
+	void uploadDecodedTextures(SDL_Renderer* renderer);
+	void waitForTextures(SDL_Renderer* renderer);
 	SDL_Texture* getTexture(const std::string& assetId);
 
 	void addFont(const std::string& assetId, const std::string& filePath, int fontSize);
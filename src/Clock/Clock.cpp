@@ -0,0 +1,15 @@
+#include "Clock.h"
+
+uint32_t Clock::ticks = 0;
+
+uint32_t Clock::getTicks() {
+	return ticks;
+}
+
+void Clock::advance(uint32_t millisecs) {
+	ticks += millisecs;
+}
+
+void Clock::setTicks(uint32_t ticks) {
+	Clock::ticks = ticks;
+}
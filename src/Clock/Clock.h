@@ -0,0 +1,22 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <cstdint>
+
+// Simulated time of the game in milliseconds, used in place of SDL_GetTicks()
+// by everything that affects the simulation. The game advances it by the delta
+// time of each frame, so replays and rollbacks see the same times as the
+// frames they run again.
+class Clock {
+
+private:
+	static uint32_t ticks;
+
+public:
+	static uint32_t getTicks();
+	static void advance(uint32_t millisecs);
+	static void setTicks(uint32_t ticks);
+
+};
+
+#endif
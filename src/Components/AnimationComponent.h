@@ -3,8 +3,11 @@
 
 #include <SDL2/SDL.h>
 #include "../ECS/ECS.h"
+#include "../Clock/Clock.h"
 
 struct AnimationComponent : IComponent {
+	static constexpr const char* SNAPSHOT_NAME = "Animation";
+	static constexpr bool SNAPSHOT_AS_BYTES = true;
 
 	int numFrames;
 	int currentFrame;
@@ -17,7 +20,7 @@ struct AnimationComponent : IComponent {
 		this->currentFrame = 1;
 		this->frameSpeedRate = frameSpeedRate;
 		this->shouldLoop = shouldLoop;
-		this->startTime = SDL_GetTicks();
+		this->startTime = Clock::getTicks();
 	}
 
 };
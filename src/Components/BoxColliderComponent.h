@@ -6,6 +6,8 @@
 #include "../ECS/ECS.h"
 
 struct BoxColliderComponent : IComponent {
+	static constexpr const char* SNAPSHOT_NAME = "BoxCollider";
+	static constexpr bool SNAPSHOT_AS_BYTES = true;
 
 	int width;
 	int height;
@@ -4,6 +4,8 @@
 #include "../ECS/ECS.h"
 
 struct CameraFollowComponent : IComponent {
+	static constexpr const char* SNAPSHOT_NAME = "CameraFollow";
+	static constexpr bool SNAPSHOT_AS_BYTES = true;
 
 	CameraFollowComponent() = default;
 
@@ -4,6 +4,8 @@
 #include "../ECS/ECS.h"
 
 struct HealthComponent : IComponent {
+	static constexpr const char* SNAPSHOT_NAME = "Health";
+	static constexpr bool SNAPSHOT_AS_BYTES = true;
 
 	int healthPercentage;
 
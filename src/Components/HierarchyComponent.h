@@ -0,0 +1,48 @@
+#ifndef HIERARCHYCOMPONENT_H
+#define HIERARCHYCOMPONENT_H
+
+#include <glm/glm.hpp>
+
+#include "../ECS/ECS.h"
+
+// Attaches the entity to a parent. The HierarchySystem keeps the entity's
+// TransformComponent as the world transform, built from the parent's transform
+// and the local offsets below. An attached entity moves by changing its local
+// offsets: the MovementSystem leaves it alone, even with a rigid body. When the
+// parent is killed or loses its transform the entity is detached and stays
+// where it was.
+struct HierarchyComponent : IComponent {
+	static constexpr const char* SNAPSHOT_NAME = "Hierarchy";
+
+	Entity parent;
+	glm::vec2 localPosition;
+	glm::vec2 localScale;
+	double localRotation;
+
+	// Without a parent the entity is detached at the next HierarchySystem update
+	HierarchyComponent(Entity parent = Entity(ENTITY_ID_MASK, ENTITY_GENERATION_MASK), glm::vec2 localPosition = glm::vec2(0, 0),
+		glm::vec2 localScale = glm::vec2(1, 1), double localRotation = 0.0): parent(parent) {
+		this->localPosition = localPosition;
+		this->localScale = localScale;
+		this->localRotation = localRotation;
+	}
+
+};
+
+// Snapshot serializer, needed because the parent holds a registry pointer
+inline void serialize(SnapshotWriter& writer, const HierarchyComponent& hierarchy) {
+	writer.write(hierarchy.parent);
+	writer.write(hierarchy.localPosition);
+	writer.write(hierarchy.localScale);
+	writer.write(hierarchy.localRotation);
+}
+
+inline bool deserialize(SnapshotReader& reader, HierarchyComponent& hierarchy) {
+	reader.read(hierarchy.parent);
+	reader.read(hierarchy.localPosition);
+	reader.read(hierarchy.localScale);
+	reader.read(hierarchy.localRotation);
+	return !reader.hasFailed();
+}
+
+#endif
@@ -6,6 +6,8 @@
 #include "../ECS/ECS.h"
 
 struct KeyboardControlledComponent : IComponent {
+	static constexpr const char* SNAPSHOT_NAME = "KeyboardControlled";
+	static constexpr bool SNAPSHOT_AS_BYTES = true;
 
 	glm::vec2 upVelocity;
 	glm::vec2 rightVelocity;
@@ -4,8 +4,11 @@
 #include <SDL2/SDL.h>
 
 #include "../ECS/ECS.h"
+#include "../Clock/Clock.h"
 
 struct ProjectileComponent : IComponent {
+	static constexpr const char* SNAPSHOT_NAME = "Projectile";
+	static constexpr bool SNAPSHOT_AS_BYTES = true;
 
 	bool isFriendly;
 	int hitPercentDamage;
@@ -16,7 +19,7 @@ struct ProjectileComponent : IComponent {
 		this->isFriendly = isFriendly;
 		this->hitPercentDamage = hitPercentDamage;
 		this->duration = duration;
-		this->startTime = SDL_GetTicks();
+		this->startTime = Clock::getTicks();
 	}
 
 };
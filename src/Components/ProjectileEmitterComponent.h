@@ -5,8 +5,11 @@
 #include <SDL2/SDL.h>
 
 #include "../ECS/ECS.h"
+#include "../Clock/Clock.h"
 
 struct ProjectileEmitterComponent : IComponent {
+	static constexpr const char* SNAPSHOT_NAME = "ProjectileEmitter";
+	static constexpr bool SNAPSHOT_AS_BYTES = true;
 
 	glm::vec2 velocity;
 	int repeatFrequency;
@@ -26,7 +29,7 @@ struct ProjectileEmitterComponent : IComponent {
 		this->duration = duration;
 		this->hitPercentDamage = hitPercentDamage;
 		this->isFriendly = isFriendly;
-		this->lastEmissionTime = SDL_GetTicks();
+		this->lastEmissionTime = Clock::getTicks();
 	}
 
 };
@@ -5,6 +5,9 @@
 #include "../ECS/ECS.h"
 
 struct RigidBodyComponent : IComponent {
+	static constexpr const char* SNAPSHOT_NAME = "RigidBody";
+	static constexpr bool SNAPSHOT_AS_BYTES = true;
+
 	glm::vec2 velocity;
 
 	RigidBodyComponent(glm::vec2 velocity = glm::vec2(0, 0)) {
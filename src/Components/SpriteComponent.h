@@ -6,6 +6,8 @@
 #include "../ECS/ECS.h"
 
 struct SpriteComponent : IComponent {
+	static constexpr const char* SNAPSHOT_NAME = "Sprite";
+
 	std::string assetId;
 	int width;
 	int height;
@@ -37,4 +39,26 @@ struct SpriteComponent : IComponent {
 
 };
 
+// Snapshot serializer, needed because of the asset id string
+inline void serialize(SnapshotWriter& writer, const SpriteComponent& sprite) {
+	writer.write(sprite.assetId);
+	writer.write(sprite.width);
+	writer.write(sprite.height);
+	writer.write(sprite.zIndex);
+	writer.write(sprite.flip);
+	writer.write(sprite.isFixed);
+	writer.write(sprite.sourceRect);
+}
+
+inline bool deserialize(SnapshotReader& reader, SpriteComponent& sprite) {
+	reader.read(sprite.assetId);
+	reader.read(sprite.width);
+	reader.read(sprite.height);
+	reader.read(sprite.zIndex);
+	reader.read(sprite.flip);
+	reader.read(sprite.isFixed);
+	reader.read(sprite.sourceRect);
+	return !reader.hasFailed();
+}
+
 #endif
\ No newline at end of file
@@ -4,8 +4,11 @@
 #include <string>
 #include <glm/glm.hpp>
 #include <SDL2/SDL.h>
+#include "../ECS/ECS.h"
 
 struct TextLabelComponent {
+	static constexpr const char* SNAPSHOT_NAME = "TextLabel";
+
 	glm::vec2 position;
 	std::string text;
 	std::string assetId;
@@ -25,4 +28,22 @@ struct TextLabelComponent {
 	}
 };
 
+// Snapshot serializer, needed because of the text and asset id strings
+inline void serialize(SnapshotWriter& writer, const TextLabelComponent& label) {
+	writer.write(label.position);
+	writer.write(label.text);
+	writer.write(label.assetId);
+	writer.write(label.color);
+	writer.write(label.isFixed);
+}
+
+inline bool deserialize(SnapshotReader& reader, TextLabelComponent& label) {
+	reader.read(label.position);
+	reader.read(label.text);
+	reader.read(label.assetId);
+	reader.read(label.color);
+	reader.read(label.isFixed);
+	return !reader.hasFailed();
+}
+
 #endif
\ No newline at end of file
@@ -5,6 +5,9 @@
 #include "../ECS/ECS.h"
 
 struct TransformComponent : IComponent {
+	static constexpr const char* SNAPSHOT_NAME = "Transform";
+	static constexpr bool SNAPSHOT_AS_BYTES = true;
+
 	glm::vec2 position;
 	glm::vec2 scale;
 	double rotation;
@@ -1,12 +1,113 @@
 #include "ECS.h"
 #include "../Logger/Logger.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 // Component
 int IComponent::nextId = 0;
+int ISystemType::nextId = 0;
+
+// Signature
+#if defined(__AVX2__)
+typedef __m256i SignatureVector;
+static const unsigned int FULL_MATCH_MASK = 0xFFFFFFFFu;
+
+static SignatureVector loadSignatureVector(const uint64_t* words) {
+	return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words));
+}
+
+// One bit per byte of the vector, set where the byte of required is also set in words
+static unsigned int matchSignatureVector(SignatureVector words, SignatureVector required) {
+	return _mm256_movemask_epi8(_mm256_cmpeq_epi64(_mm256_and_si256(words, required), required));
+}
+#elif defined(__SSE2__)
+typedef __m128i SignatureVector;
+static const unsigned int FULL_MATCH_MASK = 0xFFFFu;
+
+static SignatureVector loadSignatureVector(const uint64_t* words) {
+	return _mm_loadu_si128(reinterpret_cast<const __m128i*>(words));
+}
+
+static unsigned int matchSignatureVector(SignatureVector words, SignatureVector required) {
+	return _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(words, required), required));
+}
+#endif
+
+void matchSignatures(const Signature& required, const Signature* signatures, size_t count, uint8_t* matches) {
+	size_t i = 0;
+
+#if defined(__AVX2__) || defined(__SSE2__)
+	constexpr size_t NUM_WORDS = Signature::NUM_WORDS;
+	constexpr size_t WORDS_PER_VECTOR = sizeof(SignatureVector) / sizeof(uint64_t);
+	const uint64_t* words = reinterpret_cast<const uint64_t*>(signatures);
+
+	if constexpr (NUM_WORDS <= WORDS_PER_VECTOR) {
+		// Several signatures per vector, required is repeated in every one of them
+		constexpr size_t SIGNATURES_PER_VECTOR = WORDS_PER_VECTOR / NUM_WORDS;
+		constexpr unsigned int SIGNATURE_MASK = static_cast<unsigned int>((uint64_t(1) << sizeof(Signature)) - 1);
+
+		uint64_t requiredWords[WORDS_PER_VECTOR];
+		for (size_t word = 0; word < WORDS_PER_VECTOR; word++) {
+			requiredWords[word] = required.data()[word % NUM_WORDS];
+		}
+		const SignatureVector requiredVector = loadSignatureVector(requiredWords);
+
+		for (; i + SIGNATURES_PER_VECTOR <= count; i += SIGNATURES_PER_VECTOR) {
+			const unsigned int mask = matchSignatureVector(loadSignatureVector(words + i * NUM_WORDS), requiredVector);
+
+			for (size_t j = 0; j < SIGNATURES_PER_VECTOR; j++) {
+				matches[i + j] = ((mask >> (j * sizeof(Signature))) & SIGNATURE_MASK) == SIGNATURE_MASK;
+			}
+		}
+	} else {
+		// Several vectors per signature
+		constexpr size_t VECTORS_PER_SIGNATURE = NUM_WORDS / WORDS_PER_VECTOR;
+
+		SignatureVector requiredVectors[VECTORS_PER_SIGNATURE];
+		for (size_t vector = 0; vector < VECTORS_PER_SIGNATURE; vector++) {
+			requiredVectors[vector] = loadSignatureVector(required.data() + vector * WORDS_PER_VECTOR);
+		}
+
+		for (; i < count; i++) {
+			unsigned int mask = FULL_MATCH_MASK;
+
+			for (size_t vector = 0; vector < VECTORS_PER_SIGNATURE; vector++) {
+				mask &= matchSignatureVector(loadSignatureVector(words + i * NUM_WORDS + vector * WORDS_PER_VECTOR), requiredVectors[vector]);
+			}
+
+			matches[i] = mask == FULL_MATCH_MASK;
+		}
+	}
+#endif
+
+	for (; i < count; i++) {
+		matches[i] = signatures[i].contains(required);
+	}
+}
 
 // Entity
 int Entity::getId() const {
-	return id;
+	return handle & ENTITY_ID_MASK;
+}
+
+int Entity::getGeneration() const {
+	return (handle >> ENTITY_ID_BITS) & ENTITY_GENERATION_MASK;
+}
+
+uint32_t Entity::getHandle() const {
+	return handle;
+}
+
+bool Entity::isValid() const {
+	return registry->valid(*this);
 }
 
 void Entity::kill() {
@@ -17,30 +118,99 @@ void Entity::tag(const std::string& tag) {
 	registry->tagEntity(*this, tag);
 }
 
+void Entity::tag(int tag) {
+	registry->tagEntity(*this, tag);
+}
+
 bool Entity::hasTag(const std::string& tag) const {
 	return registry->entityHasTag(*this, tag);
 }
 
+bool Entity::hasTag(int tag) const {
+	return registry->entityHasTag(*this, tag);
+}
+
 void Entity::group(const std::string& group) {
 	registry->groupEntity(*this, group);
 }
 
+void Entity::group(int group) {
+	registry->groupEntity(*this, group);
+}
+
 bool Entity::belongsToGroup(const std::string& group) const {
 	return registry->entityBelongsToGroup(*this, group);
 }
 
+bool Entity::belongsToGroup(int group) const {
+	return registry->entityBelongsToGroup(*this, group);
+}
+
 // System
+void System::keepEntityOrder() {
+	isEntityOrderStable = true;
+}
+
 void System::addEntity(Entity entity) {
+	const int entityId = entity.getId();
+
+	if (entityId >= static_cast<int>(entityIdToIndex.size())) {
+		entityIdToIndex.resize(entityId + 1, -1);
+	}
+
+	if (entityIdToIndex[entityId] != -1) {
+		return;
+	}
+
+	entityIdToIndex[entityId] = entities.size();
 	entities.push_back(entity);
+	membershipChangeTick = registry ? registry->getCurrentTick() : 0;
 };
 
+void System::removeAllEntities() {
+	for (auto entity: entities) {
+		entityIdToIndex[entity.getId()] = -1;
+	}
+
+	entities.clear();
+	membershipChangeTick = registry ? registry->getCurrentTick() : 0;
+}
+
 void System::removeEntity(Entity entity) {
-	entities.erase(std::remove_if(entities.begin(), entities.end(), [&entity](Entity other) {
-		return entity == other;
-	}), entities.end());
+	const int entityId = entity.getId();
+
+	if (entityId >= static_cast<int>(entityIdToIndex.size()) || entityIdToIndex[entityId] == -1) {
+		return;
+	}
+
+	const int index = entityIdToIndex[entityId];
+	entityIdToIndex[entityId] = -1;
+	membershipChangeTick = registry ? registry->getCurrentTick() : 0;
+
+	if (isEntityOrderStable) {
+		entities.erase(entities.begin() + index);
+
+		for (int i = index; i < static_cast<int>(entities.size()); i++) {
+			entityIdToIndex[entities[i].getId()] = i;
+		}
+
+		return;
+	}
+
+	// Swap and pop
+	entities[index] = entities.back();
+	entities.pop_back();
+
+	if (index < static_cast<int>(entities.size())) {
+		entityIdToIndex[entities[index].getId()] = index;
+	}
 };
 
-std::vector<Entity> System::getEntities() const {
+uint32_t System::getMembershipChangeTick() const {
+	return membershipChangeTick;
+}
+
+const std::vector<Entity>& System::getEntities() const {
 	return entities;
 };
 
@@ -48,141 +218,1503 @@ const Signature& System::getComponentSignature() const {
 	return componentSignature;
 };
 
+const Signature& System::getReadSignature() const {
+	return readSignature;
+}
 
-// Registry
-Entity Registry::createEntity() {
-	int entityId;
+const Signature& System::getWriteSignature() const {
+	return writeSignature;
+}
+
+bool System::conflictsWith(const System& other) const {
+	// Systems without declarations may touch anything
+	if ((readSignature | writeSignature).none() || (other.readSignature | other.writeSignature).none()) {
+		return true;
+	}
 
-	if (freeIds.empty()) {
-		entityId = numEntities++;
+	return (writeSignature & (other.readSignature | other.writeSignature)).any() ||
+		(other.writeSignature & readSignature).any();
+}
 
-		if (entityId >= entityComponentSignatures.size()) {
-			entityComponentSignatures.resize(entityId + 1);
-		}
-	} else {
-		entityId = freeIds.front();
-		freeIds.pop_front();
+
+// Snapshots
+static const uint32_t SNAPSHOT_MAGIC = 0x53534345;
+static const uint32_t SNAPSHOT_VERSION = 4;
+
+void SnapshotWriter::write(const void* data, size_t size) {
+	const auto* begin = static_cast<const unsigned char*>(data);
+	bytes.insert(bytes.end(), begin, begin + size);
+}
+
+unsigned char* SnapshotWriter::append(size_t size) {
+	bytes.resize(bytes.size() + size);
+	return bytes.data() + bytes.size() - size;
+}
+
+void SnapshotWriter::write(const std::string& value) {
+	write<uint32_t>(value.size());
+	write(value.data(), value.size());
+}
+
+void SnapshotWriter::write(Entity entity) {
+	write<uint32_t>(entity.getHandle());
+}
+
+bool SnapshotReader::read(void* data, size_t size) {
+	const unsigned char* source = skip(size);
+
+	if (source && size > 0) {
+		std::memcpy(data, source, size);
+	}
+
+	return source != nullptr;
+}
+
+bool SnapshotReader::read(std::string& value) {
+	uint32_t length = 0;
+
+	if (!read(length)) {
+		return false;
 	}
 
-	Logger::info("Entity created with id = " + std::to_string(entityId));
+	const unsigned char* source = skip(length);
+	if (!source) {
+		return false;
+	}
 
-	Entity entity(entityId);
-	entity.registry = this;
-	entitiesToBeAdded.insert(entity);
-	return entity;
-};
+	value.assign(reinterpret_cast<const char*>(source), length);
+	return true;
+}
 
-void Registry::killEntity(Entity entity) {
-	entitiesToBeKilled.insert(entity);
-    Logger::info("Entity " + std::to_string(entity.getId()) + " was killed");
+bool SnapshotReader::read(Entity& entity) {
+	uint32_t handle = 0;
+
+	if (!read(handle)) {
+		return false;
+	}
+
+	entity = Entity(handle & ENTITY_ID_MASK, handle >> ENTITY_ID_BITS);
+	entity.registry = registry;
+	return true;
 }
 
-void Registry::update() {
-	for (auto entity: entitiesToBeAdded) {
-		addEntityToSystems(entity);
+const unsigned char* SnapshotReader::skip(size_t size) {
+	if (failed || size > this->size - offset) {
+		failed = true;
+		return nullptr;
 	}
 
-	entitiesToBeAdded.clear();
+	const unsigned char* data = bytes + offset;
+	offset += size;
+	return data;
+}
 
-	for (auto entity: entitiesToBeKilled) {
-		removeEntityFromSystems(entity);
+size_t SnapshotReader::getRemainingSize() const {
+	return size - offset;
+}
 
-		entityComponentSignatures[entity.getId()].reset();
+bool SnapshotReader::hasFailed() const {
+	return failed;
+}
 
-		freeIds.push_back(entity.getId());
-		removeEntityTag(entity);
-		removeEntityGroup(entity);
+void RegistrySnapshot::write(std::vector<unsigned char>& bytes) const {
+	SnapshotWriter writer(bytes);
+	writer.write(SNAPSHOT_MAGIC);
+	writer.write(SNAPSHOT_VERSION);
+	writer.write<uint64_t>(entities.size());
+	writer.write(entities.data(), entities.size());
+	writer.write<uint32_t>(pools.size());
+
+	for (auto& pool: pools) {
+		uint64_t blobSize = 0;
+		for (auto& piece: pool.pieces) {
+			blobSize += piece.size;
+		}
+
+		writer.write(pool.name);
+		writer.write(blobSize);
+		for (auto& piece: pool.pieces) {
+			writer.write(piece.bytes.get(), piece.size);
+		}
 	}
-	entitiesToBeKilled.clear();
-};
+}
 
-void Registry::addEntityToSystems(Entity entity) {
-	const auto entityId = entity.getId();
+bool RegistrySnapshot::read(const std::shared_ptr<const std::vector<unsigned char>>& bytes) {
+	SnapshotReader reader(bytes->data(), bytes->size());
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	uint64_t entitiesSize = 0;
+	uint32_t numPools = 0;
+
+	if (!reader.read(magic) || !reader.read(version) || magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION) {
+		return false;
+	}
 
-	const auto& entityComponentSignature = entityComponentSignatures[entityId];
+	reader.read(entitiesSize);
+	const unsigned char* entityBytes = reader.skip(entitiesSize);
+	reader.read(numPools);
 
-	for (auto& system: systems) {
-		const auto& systemComponentSignature = system.second->getComponentSignature();
+	if (reader.hasFailed()) {
+		return false;
+	}
+
+	entities.assign(entityBytes, entityBytes + entitiesSize);
+	pools.clear();
 
-		bool isInterested = (entityComponentSignature & systemComponentSignature) == systemComponentSignature;
+	for (uint32_t pool = 0; pool < numPools; pool++) {
+		PoolBlob blob;
+		uint64_t blobSize = 0;
+		reader.read(blob.name);
+		reader.read(blobSize);
+		const unsigned char* blobBytes = reader.skip(blobSize);
 
-		if (isInterested) {
-			system.second->addEntity(entity);
+		if (reader.hasFailed()) {
+			return false;
 		}
+
+		blob.pieces.push_back({std::shared_ptr<const unsigned char>(bytes, blobBytes), blobSize});
+		pools.push_back(std::move(blob));
 	}
 
+	return true;
 }
 
-void Registry::removeEntityFromSystems(Entity entity) {
-	for (auto system : systems) {
-		system.second->removeEntity(entity);
-	}
+// RollbackBuffer
+RollbackBuffer::RollbackBuffer(int capacity): snapshots(std::max(capacity, 1)), frames(std::max(capacity, 1), -1) {}
+
+int RollbackBuffer::getSlot(int frame) const {
+	return frame % static_cast<int>(frames.size());
 }
 
-void Registry::tagEntity(Entity entity, const std::string& tag) {
-	entityPerTag.emplace(tag, entity);
-	tagPerEntity.emplace(entity.getId(), tag);
+int RollbackBuffer::getCapacity() const {
+	return frames.size();
 }
 
-bool Registry::entityHasTag(Entity entity, const std::string& tag) const {
-	if (tagPerEntity.find(entity.getId()) == tagPerEntity.end()) {
+bool RollbackBuffer::hasFrame(int frame) const {
+	return frame >= 0 && frames[getSlot(frame)] == frame;
+}
+
+bool RollbackBuffer::save(const Registry& registry, int frame) {
+	const int slot = getSlot(frame);
+
+	// The slot keeps the capacity of its buffers from the frame it held before
+	const bool isSaved = registry.saveSnapshot(snapshots[slot]);
+	frames[slot] = isSaved ? frame : -1;
+	return isSaved;
+}
+
+bool RollbackBuffer::restore(Registry& registry, int frame) {
+	if (!hasFrame(frame) || !registry.loadSnapshot(snapshots[getSlot(frame)])) {
 		return false;
 	}
-	return entityPerTag.find(tag)->second == entity;
+
+	for (auto& savedFrame: frames) {
+		if (savedFrame > frame) {
+			savedFrame = -1;
+		}
+	}
+
+	return true;
 }
 
-Entity Registry::getEntityByTag(const std::string& tag) const {
-	return entityPerTag.at(tag);
+void RollbackBuffer::clear() {
+	for (auto& snapshot: snapshots) {
+		snapshot.entities.clear();
+		snapshot.pools.clear();
+	}
+
+	std::fill(frames.begin(), frames.end(), -1);
 }
 
-void Registry::removeEntityTag(Entity entity) {
-	auto taggedEntity = tagPerEntity.find(entity.getId());
-	if (taggedEntity != tagPerEntity.end()) {
-		auto tag = taggedEntity->second;
-		entityPerTag.erase(tag);
-		tagPerEntity.erase(taggedEntity);
+// Prefab
+Prefab::Prefab(const std::string& name): name(name) {}
+
+const std::string& Prefab::getName() const {
+	return name;
+}
+
+const Signature& Prefab::getSignature() const {
+	return signature;
+}
+
+Prefab& Prefab::group(int group) {
+	groups.set(group);
+	return *this;
+}
+
+// CommandBuffer
+CommandBuffer::~CommandBuffer() {
+	clear();
+}
+
+void* CommandBuffer::allocate(size_t size, size_t alignment) {
+	while (true) {
+		if (currentBlock == blocks.size()) {
+			const size_t blockSize = std::max(BLOCK_SIZE, size + alignment);
+			blocks.emplace_back(new unsigned char[blockSize]);
+			blockSizes.push_back(blockSize);
+		}
+
+		// Align the address rather than the offset, blocks are only aligned for
+		// fundamental types
+		const uintptr_t base = reinterpret_cast<uintptr_t>(blocks[currentBlock].get());
+		const size_t offset = ((base + currentOffset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+
+		if (offset + size <= blockSizes[currentBlock]) {
+			currentOffset = offset + size;
+			return blocks[currentBlock].get() + offset;
+		}
+
+		currentBlock++;
+		currentOffset = 0;
 	}
 }
 
-void Registry::groupEntity(Entity entity, const std::string& group) {
-	entitiesPerGroup.emplace(group, std::set<Entity>());
-    entitiesPerGroup[group].emplace(entity);
-    groupPerEntity.emplace(entity.getId(), group);
+void CommandBuffer::record(void (*apply)(Registry&, Entity, void*), void (*destroy)(void*), Entity entity, int pendingIndex, void* payload) {
+	Command command = {apply, destroy, entity, pendingIndex, payload};
+	commands.push_back(command);
 }
 
-bool Registry::entityBelongsToGroup(Entity entity, const std::string& group) const {
-	if (entitiesPerGroup.find(group) == entitiesPerGroup.end()) {
-		return false;
+void CommandBuffer::applyKillEntity(Registry& registry, Entity entity, void*) {
+	registry.entitiesToBeKilled.push_back(entity);
+}
+
+void CommandBuffer::applyGroupEntity(Registry& registry, Entity entity, void* payload) {
+	registry.groupEntity(entity, *static_cast<int*>(payload));
+}
+
+void CommandBuffer::applyTagEntity(Registry& registry, Entity entity, void* payload) {
+	registry.tagEntity(entity, *static_cast<int*>(payload));
+}
+
+PendingEntity CommandBuffer::instantiate(const Prefab& prefab, int count) {
+	PendingEntity entity = {numPendingEntities};
+	numPendingEntities += count;
+	void* payload = createPayload<InstantiatePayload>(InstantiatePayload{&prefab, count});
+	record(nullptr, nullptr, Entity(0), entity.index, payload);
+	return entity;
+}
+
+PendingEntity CommandBuffer::createEntity() {
+	PendingEntity entity = {numPendingEntities++};
+	record(nullptr, nullptr, Entity(0), entity.index, nullptr);
+	return entity;
+}
+
+void CommandBuffer::killEntity(Entity entity) {
+	record(&CommandBuffer::applyKillEntity, nullptr, entity, -1, nullptr);
+}
+
+void CommandBuffer::tagEntity(PendingEntity entity, int tag) {
+	void* payload = createPayload<int>(tag);
+	record(&CommandBuffer::applyTagEntity, nullptr, Entity(0), entity.index, payload);
+}
+
+void CommandBuffer::groupEntity(PendingEntity entity, int group) {
+	void* payload = createPayload<int>(group);
+	record(&CommandBuffer::applyGroupEntity, nullptr, Entity(0), entity.index, payload);
+}
+
+bool CommandBuffer::isEmpty() const {
+	return commands.empty();
+}
+
+void CommandBuffer::apply(Registry& registry) {
+	createdEntities.clear();
+
+	for (auto& command: commands) {
+		// A null apply function creates entities, from a prefab when there's a payload
+		if (!command.apply) {
+			if (command.payload) {
+				const auto& instantiate = *static_cast<InstantiatePayload*>(command.payload);
+				registry.instantiate(*instantiate.prefab, instantiate.count, createdEntities);
+			} else {
+				createdEntities.push_back(registry.createEntity());
+			}
+			continue;
+		}
+
+		const Entity entity = command.pendingIndex == -1 ? command.entity : createdEntities[command.pendingIndex];
+		command.apply(registry, entity, command.payload);
+
+		if (command.destroy) {
+			command.destroy(command.payload);
+		}
 	}
 
-	auto groupEntities = entitiesPerGroup.at(group);
-    return groupEntities.find(entity.getId()) != groupEntities.end();
+	commands.clear();
+	currentBlock = 0;
+	currentOffset = 0;
+	numPendingEntities = 0;
 }
 
-std::vector<Entity> Registry::getEntitiesByGroup(const std::string& group) const {
-	auto &setOfEntities = entitiesPerGroup.at(group);
-	return std::vector<Entity>(setOfEntities.begin(), setOfEntities.end());
+void CommandBuffer::clear() {
+	for (auto& command: commands) {
+		if (command.destroy) {
+			command.destroy(command.payload);
+		}
+	}
+
+	commands.clear();
+	currentBlock = 0;
+	currentOffset = 0;
+	numPendingEntities = 0;
 }
 
-void Registry::removeEntityGroup(Entity entity) {
-	auto groupedEntity = groupPerEntity.find(entity.getId());
-	if (groupedEntity != groupPerEntity.end()) {
-		auto group = entitiesPerGroup.find(groupedEntity->second);
-		if (group != entitiesPerGroup.end()) {
-			auto entityInGroup = group->second.find(entity);
-			if (entityInGroup != group->second.end()) {
-				group->second.erase(entityInGroup);
+// Archetype
+Archetype::Archetype(const Signature& signature, const ComponentInfo* const* componentInfos): signature(signature) {
+	size_t rowSize = sizeof(Entity);
+
+	for (int componentId = 0; componentId < static_cast<int>(MAX_COMPONENTS); componentId++) {
+		this->componentInfos[componentId] = signature.test(componentId) ? componentInfos[componentId] : nullptr;
+		columnOffsets[componentId] = 0;
+		addEdges[componentId] = -1;
+		removeEdges[componentId] = -1;
+
+		if (signature.test(componentId)) {
+			componentIds.push_back(componentId);
+			rowSize += componentInfos[componentId]->size;
+		}
+	}
+
+	// Fit as many rows as possible, leaving room for the alignment padding
+	// between the component arrays
+	for (chunkCapacity = ARCHETYPE_CHUNK_BYTES / rowSize; chunkCapacity > 0; chunkCapacity--) {
+		size_t offset = chunkCapacity * sizeof(Entity);
+
+		for (int componentId: componentIds) {
+			const ComponentInfo& info = *componentInfos[componentId];
+			offset = (offset + info.alignment - 1) & ~(info.alignment - 1);
+			columnOffsets[componentId] = offset;
+			offset += chunkCapacity * info.size;
+		}
+
+		if (offset <= ARCHETYPE_CHUNK_BYTES) {
+			break;
+		}
+	}
+
+	// Rows are indexed by dividing by the capacity
+	if (chunkCapacity == 0) {
+		Logger::error("Archetype components don't fit in a chunk");
+		std::abort();
+	}
+}
+
+int Archetype::getChunkSize(int chunk) const {
+	return std::min(chunkCapacity, size - chunk * chunkCapacity);
+}
+
+Entity* Archetype::getEntities(int chunk) const {
+	return reinterpret_cast<Entity*>(chunks[chunk]->bytes);
+}
+
+void* Archetype::getComponent(int row, int componentId) const {
+	const int chunk = row / chunkCapacity;
+	const int index = row - chunk * chunkCapacity;
+	return chunks[chunk]->bytes + columnOffsets[componentId] + index * componentInfos[componentId]->size;
+}
+
+const ComponentInfo& Archetype::getComponentInfo(int componentId) const {
+	return *componentInfos[componentId];
+}
+
+void Archetype::stamp(int chunk, int componentId, uint32_t tick) {
+	auto& changeTick = chunks[chunk]->changeTicks[componentId];
+
+	if (changeTick.load(std::memory_order_relaxed) < tick) {
+		changeTick.store(tick, std::memory_order_relaxed);
+	}
+}
+
+// ArchetypeStorage
+ArchetypeStorage::ArchetypeStorage(const uint32_t* currentTick): currentTick(currentTick) {
+}
+
+ArchetypeStorage::~ArchetypeStorage() {
+	for (auto& archetype: archetypes) {
+		for (int row = 0; row < archetype->size; row++) {
+			for (int componentId: archetype->componentIds) {
+				archetype->getComponentInfo(componentId).destroy(archetype->getComponent(row, componentId));
 			}
 		}
-		groupPerEntity.erase(groupedEntity);
 	}
 }
 
+const std::vector<std::unique_ptr<Archetype>>& ArchetypeStorage::getArchetypes() const {
+	return archetypes;
+}
+
+uint32_t ArchetypeStorage::getChangeTick(int entityId, int componentId) const {
+	const EntityLocation& location = entityLocations[entityId];
+	const Archetype& archetype = *archetypes[location.archetype];
+	return archetype.chunks[location.row / archetype.chunkCapacity]->changeTicks[componentId].load(std::memory_order_relaxed);
+}
+
+uint32_t ArchetypeStorage::getCurrentTick() const {
+	return *currentTick;
+}
+
+ArchetypeStorage::EntityLocation& ArchetypeStorage::getLocation(int entityId) {
+	if (entityId >= static_cast<int>(entityLocations.size())) {
+		entityLocations.resize(entityId + 1, EntityLocation{-1, -1});
+	}
+
+	return entityLocations[entityId];
+}
+
+int ArchetypeStorage::getArchetype(const Signature& signature) {
+	auto archetypeIndex = archetypeIndices.find(signature);
+
+	if (archetypeIndex != archetypeIndices.end()) {
+		return archetypeIndex->second;
+	}
+
+	archetypes.push_back(std::make_unique<Archetype>(signature, componentInfos));
+	archetypeIndices.emplace(signature, archetypes.size() - 1);
+	return archetypes.size() - 1;
+}
+
+// Chunks are kept when the archetype shrinks, and reused when it grows again
+void ArchetypeStorage::assureChunk(Archetype& archetype, int chunk) {
+	if (chunk == static_cast<int>(archetype.chunks.size())) {
+		archetype.chunks.push_back(std::make_unique<ArchetypeChunk>());
+		for (auto& changeTick: archetype.chunks.back()->changeTicks) {
+			changeTick.store(0, std::memory_order_relaxed);
+		}
+	}
+}
+
+int ArchetypeStorage::appendRow(Archetype& archetype, Entity entity) {
+	const int row = archetype.size;
+	const int chunk = row / archetype.chunkCapacity;
 
+	assureChunk(archetype, chunk);
 
+	archetype.getEntities(chunk)[row - chunk * archetype.chunkCapacity] = entity;
+	archetype.size++;
 
+	for (int componentId: archetype.componentIds) {
+		archetype.stamp(chunk, componentId, *currentTick);
+	}
 
+	return row;
+}
 
+void ArchetypeStorage::instantiate(const Signature& signature, const Entity* entities, int count,
+	const void* const* values, const ComponentInfo* const* infos) {
+	if (signature.none()) {
+		return;
+	}
 
+	for (int componentId = 0; componentId < static_cast<int>(MAX_COMPONENTS); componentId++) {
+		if (signature.test(componentId)) {
+			componentInfos[componentId] = infos[componentId];
+		}
+	}
 
+	const int archetypeIndex = getArchetype(signature);
+	Archetype& archetype = *archetypes[archetypeIndex];
 
+	while (count > 0) {
+		const int row = archetype.size;
+		const int chunk = row / archetype.chunkCapacity;
+		const int chunkRow = row - chunk * archetype.chunkCapacity;
+		const int run = std::min(count, archetype.chunkCapacity - chunkRow);
+
+		assureChunk(archetype, chunk);
+		std::copy(entities, entities + run, archetype.getEntities(chunk) + chunkRow);
+
+		for (int componentId: archetype.componentIds) {
+			infos[componentId]->copyConstruct(archetype.getComponent(row, componentId), values[componentId], run);
+			archetype.stamp(chunk, componentId, *currentTick);
+		}
+
+		for (int i = 0; i < run; i++) {
+			getLocation(entities[i].getId()) = EntityLocation{archetypeIndex, row + i};
+		}
+
+		archetype.size += run;
+		entities += run;
+		count -= run;
+	}
+}
+
+// Moves the last row into the hole so the chunks stay packed
+void ArchetypeStorage::removeRow(int archetypeIndex, int row) {
+	Archetype& archetype = *archetypes[archetypeIndex];
+	const int lastRow = archetype.size - 1;
+
+	for (int componentId: archetype.componentIds) {
+		const ComponentInfo& info = archetype.getComponentInfo(componentId);
+		info.destroy(archetype.getComponent(row, componentId));
+
+		if (row != lastRow) {
+			info.moveConstruct(archetype.getComponent(row, componentId), archetype.getComponent(lastRow, componentId));
+			info.destroy(archetype.getComponent(lastRow, componentId));
+			archetype.stamp(row / archetype.chunkCapacity, componentId, *currentTick);
+		}
+	}
+
+	if (row != lastRow) {
+		const int lastChunk = lastRow / archetype.chunkCapacity;
+		const Entity movedEntity = archetype.getEntities(lastChunk)[lastRow - lastChunk * archetype.chunkCapacity];
+
+		const int chunk = row / archetype.chunkCapacity;
+		archetype.getEntities(chunk)[row - chunk * archetype.chunkCapacity] = movedEntity;
+		entityLocations[movedEntity.getId()].row = row;
+	}
+
+	archetype.size--;
+}
+
+int ArchetypeStorage::moveEntity(Entity entity, int targetArchetype) {
+	EntityLocation& location = getLocation(entity.getId());
+	Archetype& target = *archetypes[targetArchetype];
+	const int targetRow = appendRow(target, entity);
+
+	if (location.archetype != -1) {
+		Archetype& source = *archetypes[location.archetype];
+
+		for (int componentId: source.componentIds) {
+			if (target.signature.test(componentId)) {
+				source.getComponentInfo(componentId).moveConstruct(target.getComponent(targetRow, componentId), source.getComponent(location.row, componentId));
+			}
+		}
+
+		// Destroys the moved-from components and the ones the target doesn't have
+		removeRow(location.archetype, location.row);
+	}
+
+	location.archetype = targetArchetype;
+	location.row = targetRow;
+	return targetRow;
+}
+
+void ArchetypeStorage::remove(Entity entity, int componentId) {
+	EntityLocation& location = getLocation(entity.getId());
+
+	if (location.archetype == -1 || !archetypes[location.archetype]->signature.test(componentId)) {
+		return;
+	}
+
+	Archetype& archetype = *archetypes[location.archetype];
+
+	if (archetype.componentIds.size() == 1) {
+		removeEntity(entity);
+		return;
+	}
+
+	if (archetype.removeEdges[componentId] == -1) {
+		Signature signature = archetype.signature;
+		signature.reset(componentId);
+		archetype.removeEdges[componentId] = getArchetype(signature);
+	}
+
+	moveEntity(entity, archetype.removeEdges[componentId]);
+}
+
+void ArchetypeStorage::removeEntity(Entity entity) {
+	EntityLocation& location = getLocation(entity.getId());
+
+	if (location.archetype == -1) {
+		return;
+	}
+
+	removeRow(location.archetype, location.row);
+	location.archetype = -1;
+	location.row = -1;
+}
+
+// DeferredChangesScope
+static thread_local bool isDeferringChanges = false;
+
+DeferredChangesScope::DeferredChangesScope(): wasDeferring(isDeferringChanges) {
+	isDeferringChanges = true;
+}
+
+DeferredChangesScope::~DeferredChangesScope() {
+	isDeferringChanges = wasDeferring;
+}
+
+bool DeferredChangesScope::isActive() {
+	return isDeferringChanges;
+}
+
+// Registry
+Registry::Registry(StorageMode storageMode) {
+	if (storageMode == ARCHETYPE_STORAGE) {
+		archetypeStorage = std::make_unique<ArchetypeStorage>(&currentTick);
+	}
+}
+
+StorageMode Registry::getStorageMode() const {
+	return archetypeStorage ? ARCHETYPE_STORAGE : SPARSE_SET_STORAGE;
+}
+
+int Registry::getThreadSlot() {
+	return ThreadSlots::get();
+}
+
+CommandBuffer& Registry::getCommandBuffer() {
+	return commandBuffers[getThreadSlot()];
+}
+
+void Registry::setJobSystem(JobSystem* jobSystem) {
+	this->jobSystem = jobSystem;
+}
+
+JobSystem* Registry::getJobSystem() const {
+	return jobSystem;
+}
+
+uint32_t Registry::getCurrentTick() const {
+	return currentTick;
+}
+
+Entity Registry::allocateEntity() {
+	int entityId;
+	int generation;
+
+	if (nextFreeId == -1) {
+		entityId = entityHandles.size();
+		generation = 0;
+
+		// Going on would alias the handles of other entities
+		if (entityId >= static_cast<int>(MAX_ENTITIES)) {
+			Logger::error("Maximum number of entities reached");
+			std::abort();
+		}
+
+		entityHandles.push_back(Entity(entityId, generation).getHandle());
+		entityComponentSignatures.resize(entityId + 1);
+		entitySystemSignatures.resize(entityId + 1);
+		entityIsInSystems.resize(entityId + 1, false);
+		entityIsQueuedForRefresh.resize(entityId + 1, false);
+		entityTags.resize(entityId + 1, -1);
+		entityGroupSignatures.resize(entityId + 1);
+	} else {
+		// Pop the id from the implicit free list
+		const Entity freeSlot(entityHandles[nextFreeId] & ENTITY_ID_MASK, entityHandles[nextFreeId] >> ENTITY_ID_BITS);
+		entityId = nextFreeId;
+		generation = freeSlot.getGeneration();
+		nextFreeId = freeSlot.getId() == static_cast<int>(ENTITY_ID_MASK) ? -1 : freeSlot.getId();
+		if (nextFreeId == -1) {
+			lastFreeId = -1;
+		}
+		entityHandles[entityId] = Entity(entityId, generation).getHandle();
+	}
+
+	Entity entity(entityId, generation);
+	entity.registry = this;
+	queueSystemsRefresh(entity);
+	return entity;
+}
+
+Entity Registry::createEntity() {
+	const Entity entity = allocateEntity();
+	Logger::info("Entity created with id = " + std::to_string(entity.getId()));
+	return entity;
+}
+
+bool Registry::valid(Entity entity) const {
+	const int entityId = entity.getId();
+	return entityId < static_cast<int>(entityHandles.size()) && entityHandles[entityId] == entity.getHandle();
+}
+
+Prefab& Registry::createPrefab(const std::string& name) {
+	// Cleared in place, so pointers to the prefab stay valid
+	auto& prefab = prefabs[name];
+	if (prefab) {
+		*prefab = Prefab(name);
+	} else {
+		prefab = std::make_unique<Prefab>(name);
+	}
+	return *prefab;
+}
+
+const Prefab* Registry::getPrefab(const std::string& name) const {
+	const auto prefab = prefabs.find(name);
+	return prefab != prefabs.end() ? prefab->second.get() : nullptr;
+}
+
+std::vector<Entity> Registry::instantiate(const Prefab& prefab, int count) {
+	std::vector<Entity> entities;
+	entities.reserve(count);
+	instantiate(prefab, count, entities);
+	return entities;
+}
+
+void Registry::instantiate(const Prefab& prefab, int count, std::vector<Entity>& entities) {
+	const size_t firstEntity = entities.size();
+
+	for (int i = 0; i < count; i++) {
+		const Entity entity = allocateEntity();
+		entityComponentSignatures[entity.getId()] = prefab.signature;
+		entities.push_back(entity);
+	}
+
+	const Entity* newEntities = entities.data() + firstEntity;
+
+	if (archetypeStorage) {
+		const void* values[MAX_COMPONENTS] = {};
+		const ComponentInfo* infos[MAX_COMPONENTS] = {};
+
+		for (auto& component: prefab.components) {
+			values[component.componentId] = component.value.get();
+			infos[component.componentId] = component.info;
+		}
+
+		archetypeStorage->instantiate(prefab.signature, newEntities, count, values, infos);
+	} else {
+		bool isOwned = false;
+
+		for (auto& component: prefab.components) {
+			component.instantiate(*this, component.value.get(), newEntities, count);
+			isOwned = isOwned || componentPools[component.componentId]->owningGroup != -1;
+		}
+
+		if (isOwned) {
+			for (int i = 0; i < count; i++) {
+				addEntityToOwningGroups(newEntities[i]);
+			}
+		}
+	}
+
+	for (int group = 0; group < static_cast<int>(MAX_GROUPS); group++) {
+		if (prefab.groups.test(group)) {
+			for (int i = 0; i < count; i++) {
+				groupEntity(newEntities[i], group);
+			}
+		}
+	}
+}
+
+void Registry::killEntity(Entity entity) {
+	getCommandBuffer().killEntity(entity);
+}
+
+void Registry::update() {
+	// Everything from here until the next update is stamped with the new tick
+	currentTick++;
+
+	// Apply the structural changes recorded by every thread. Entities created by
+	// the buffers get all their components before they're matched with the systems.
+	for (auto& commandBuffer: commandBuffers) {
+		if (!commandBuffer.isEmpty()) {
+			commandBuffer.apply(*this);
+		}
+	}
+
+	if (entitiesToBeRefreshed.size() >= BULK_REFRESH_THRESHOLD) {
+		refreshSystemsInBulk();
+	} else {
+		for (auto entity: entitiesToBeRefreshed) {
+			entityIsQueuedForRefresh[entity.getId()] = false;
+
+			if (valid(entity)) {
+				refreshEntitySystems(entity);
+			}
+		}
+	}
+
+	entitiesToBeRefreshed.clear();
+
+	// Ids go back to the free list in handle order rather than in the order the
+	// thread slots recorded the kills, so the ids handed out next don't depend on
+	// which worker ran a chunk
+	std::sort(entitiesToBeKilled.begin(), entitiesToBeKilled.end());
+
+	for (auto entity: entitiesToBeKilled) {
+		// Stale handles, or entities killed twice in the same frame
+		if (!valid(entity)) {
+			continue;
+		}
+
+		Logger::info("Entity " + std::to_string(entity.getId()) + " was killed");
+
+		removeEntityFromSystems(entity);
+
+		for (auto& group: owningGroups) {
+			if (isInOwningGroup(*group, entity.getId())) {
+				removeEntityFromOwningGroup(*group, entity.getId());
+			}
+		}
+
+		for (auto& pool: componentPools) {
+			if (pool) {
+				pool->removeEntityFromPool(entity.getId());
+			}
+		}
+
+		if (archetypeStorage) {
+			archetypeStorage->removeEntity(entity);
+		}
+
+		entityComponentSignatures[entity.getId()].reset();
+
+		removeEntityTag(entity);
+		removeEntityGroup(entity);
+
+		// Retire the id rather than let its generation wrap around to handles
+		// that may still be held
+		const int nextGeneration = entity.getGeneration() + 1;
+		if (nextGeneration > static_cast<int>(ENTITY_GENERATION_MASK)) {
+			entityHandles[entity.getId()] = Entity(ENTITY_ID_MASK, 0).getHandle();
+			Logger::info("Entity id " + std::to_string(entity.getId()) + " retired, its generations ran out");
+			continue;
+		}
+
+		// Append the id to the end of the implicit free list with its next generation
+		entityHandles[entity.getId()] = Entity(ENTITY_ID_MASK, nextGeneration).getHandle();
+		if (lastFreeId == -1) {
+			nextFreeId = entity.getId();
+		} else {
+			const uint32_t lastFreeGeneration = entityHandles[lastFreeId] >> ENTITY_ID_BITS;
+			entityHandles[lastFreeId] = Entity(entity.getId(), lastFreeGeneration).getHandle();
+		}
+		lastFreeId = entity.getId();
+	}
+	entitiesToBeKilled.clear();
+};
+
+const Registry::OwningGroupData* Registry::findOrCreateOwningGroup(const Signature& signature, const std::vector<IPool*>& pools) {
+	for (auto& group: owningGroups) {
+		if (group->signature == signature) {
+			return group.get();
+		}
+	}
+
+	for (auto pool: pools) {
+		if (pool->owningGroup != -1) {
+			Logger::error("A component of the owning group is already owned by another group");
+			return nullptr;
+		}
+	}
+
+	const int groupIndex = owningGroups.size();
+	owningGroups.push_back(std::make_unique<OwningGroupData>());
+
+	OwningGroupData& group = *owningGroups.back();
+	group.signature = signature;
+	group.pools = pools;
+
+	for (auto pool: pools) {
+		pool->owningGroup = groupIndex;
+	}
+
+	// Pack the entities that already have every component. Packing only moves
+	// components to indices that were already visited.
+	const auto& entities = pools[0]->getEntities();
+	for (size_t i = 0; i < entities.size(); i++) {
+		const Entity entity = entities[i];
+
+		if (entityComponentSignatures[entity.getId()].contains(signature)) {
+			for (auto pool: group.pools) {
+				pool->swap(pool->getIndex(entity.getId()), group.size);
+			}
+			group.size++;
+		}
+	}
+
+	return &group;
+}
+
+bool Registry::isInOwningGroup(const OwningGroupData& group, int entityId) const {
+	const int index = group.pools[0]->getIndex(entityId);
+	return index != -1 && index < group.size;
+}
+
+void Registry::addEntityToOwningGroups(Entity entity) {
+	const int entityId = entity.getId();
+	const auto& signature = entityComponentSignatures[entityId];
+
+	for (auto& group: owningGroups) {
+		if ((signature & group->signature) != group->signature || isInOwningGroup(*group, entityId)) {
+			continue;
+		}
+
+		for (auto pool: group->pools) {
+			pool->swap(pool->getIndex(entityId), group->size);
+		}
+		group->size++;
+	}
+}
+
+void Registry::removeEntityFromOwningGroup(OwningGroupData& group, int entityId) {
+	group.size--;
+
+	for (auto pool: group.pools) {
+		pool->swap(pool->getIndex(entityId), group.size);
+	}
+}
+
+void Registry::queueSystemsRefresh(Entity entity) {
+	const auto entityId = entity.getId();
+
+	if (!entityIsQueuedForRefresh[entityId]) {
+		entityIsQueuedForRefresh[entityId] = true;
+		entitiesToBeRefreshed.push_back(entity);
+	}
+}
+
+const std::vector<System*>& Registry::getInterestedSystems(const Signature& signature) {
+	auto interestedSystems = systemsPerSignature.find(signature);
+
+	if (interestedSystems == systemsPerSignature.end()) {
+		std::vector<System*> matchingSystems;
+
+		for (auto& system: systems) {
+			if (!system) {
+				continue;
+			}
+
+			const auto& systemComponentSignature = system->getComponentSignature();
+
+			if ((signature & systemComponentSignature) == systemComponentSignature) {
+				matchingSystems.push_back(system.get());
+			}
+		}
+
+		interestedSystems = systemsPerSignature.emplace(signature, std::move(matchingSystems)).first;
+	}
+
+	return interestedSystems->second;
+}
+
+// Only the systems whose interest differs between the old and new signature are touched
+void Registry::refreshEntitySystems(Entity entity) {
+	const auto entityId = entity.getId();
+
+	if (!entityIsInSystems[entityId]) {
+		addEntityToSystems(entity);
+		return;
+	}
+
+	const Signature oldSignature = entitySystemSignatures[entityId];
+	const Signature& newSignature = entityComponentSignatures[entityId];
+
+	if (oldSignature == newSignature) {
+		return;
+	}
+
+	for (auto system: getInterestedSystems(oldSignature)) {
+		const auto& systemComponentSignature = system->getComponentSignature();
+
+		if ((newSignature & systemComponentSignature) != systemComponentSignature) {
+			system->removeEntity(entity);
+		}
+	}
+
+	for (auto system: getInterestedSystems(newSignature)) {
+		const auto& systemComponentSignature = system->getComponentSignature();
+
+		if ((oldSignature & systemComponentSignature) != systemComponentSignature) {
+			system->addEntity(entity);
+		}
+	}
+
+	entitySystemSignatures[entityId] = newSignature;
+}
+
+// Same result as refreshing every queued entity, but each system signature is
+// matched against all the old and new signatures at once
+void Registry::refreshSystemsInBulk() {
+	bulkRefreshEntities.clear();
+	bulkRefreshOldSignatures.clear();
+	bulkRefreshNewSignatures.clear();
+	bulkRefreshWasInSystems.clear();
+
+	for (auto entity: entitiesToBeRefreshed) {
+		const auto entityId = entity.getId();
+		entityIsQueuedForRefresh[entityId] = false;
+
+		if (!valid(entity)) {
+			continue;
+		}
+
+		bulkRefreshEntities.push_back(entity);
+		bulkRefreshOldSignatures.push_back(entitySystemSignatures[entityId]);
+		bulkRefreshNewSignatures.push_back(entityComponentSignatures[entityId]);
+		bulkRefreshWasInSystems.push_back(entityIsInSystems[entityId]);
+	}
+
+	const size_t count = bulkRefreshEntities.size();
+	bulkRefreshOldMatches.resize(count);
+	bulkRefreshNewMatches.resize(count);
+
+	for (auto& system: systems) {
+		if (!system) {
+			continue;
+		}
+
+		const auto& systemComponentSignature = system->getComponentSignature();
+		matchSignatures(systemComponentSignature, bulkRefreshOldSignatures.data(), count, bulkRefreshOldMatches.data());
+		matchSignatures(systemComponentSignature, bulkRefreshNewSignatures.data(), count, bulkRefreshNewMatches.data());
+
+		for (size_t i = 0; i < count; i++) {
+			// Entities that were never added had no old match, whatever their old signature
+			const bool oldMatch = bulkRefreshWasInSystems[i] && bulkRefreshOldMatches[i];
+			const bool newMatch = bulkRefreshNewMatches[i];
+
+			if (oldMatch && !newMatch) {
+				system->removeEntity(bulkRefreshEntities[i]);
+			} else if (!oldMatch && newMatch) {
+				system->addEntity(bulkRefreshEntities[i]);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		const auto entityId = bulkRefreshEntities[i].getId();
+		entitySystemSignatures[entityId] = bulkRefreshNewSignatures[i];
+		entityIsInSystems[entityId] = true;
+	}
+}
+
+void Registry::addEntityToSystems(Entity entity) {
+	const auto entityId = entity.getId();
+
+	for (auto system: getInterestedSystems(entityComponentSignatures[entityId])) {
+		system->addEntity(entity);
+	}
+
+	entitySystemSignatures[entityId] = entityComponentSignatures[entityId];
+	entityIsInSystems[entityId] = true;
+}
+
+void Registry::removeEntityFromSystems(Entity entity) {
+	const auto entityId = entity.getId();
+
+	if (!entityIsInSystems[entityId]) {
+		return;
+	}
+
+	for (auto system: getInterestedSystems(entitySystemSignatures[entityId])) {
+		system->removeEntity(entity);
+	}
+
+	entitySystemSignatures[entityId].reset();
+	entityIsInSystems[entityId] = false;
+}
+
+std::unordered_map<std::string, int> Registry::tagIds;
+std::unordered_map<std::string, int> Registry::groupIds;
+std::unordered_map<std::string, IPool* (*)(Registry& registry)> Registry::snapshotPoolTypes;
+
+// Names may be interned from any thread, every registry shares them
+static std::mutex internedNamesMutex;
+
+// Interned ids are only stable within a run, so snapshots keep the names by id
+static void writeInternedNames(SnapshotWriter& writer, const std::unordered_map<std::string, int>& ids) {
+	std::vector<const std::string*> names(ids.size());
+
+	for (auto& id: ids) {
+		names[id.second] = &id.first;
+	}
+
+	writer.write<uint32_t>(names.size());
+	for (auto name: names) {
+		writer.write(*name);
+	}
+}
+
+static void readInternedNames(SnapshotReader& reader, std::vector<std::string>& names) {
+	uint32_t numNames = 0;
+	reader.read(numNames);
+
+	for (uint32_t name = 0; name < numNames && !reader.hasFailed(); name++) {
+		names.emplace_back();
+		reader.read(names.back());
+	}
+}
+
+bool Registry::saveSnapshot(RegistrySnapshot& snapshot) const {
+	snapshot.entities.clear();
+	snapshot.pools.clear();
+
+	if (archetypeStorage) {
+		Logger::error("Registry snapshots need sparse set storage");
+		return false;
+	}
+
+	// Loading the snapshot would silently drop these components
+	for (auto& pool: componentPools) {
+		if (pool && !pool->getSnapshotName() && !pool->getEntities().empty()) {
+			Logger::error("Registry snapshot refused, components of type " + std::string(pool->getTypeName()) + " have no SNAPSHOT_NAME");
+			return false;
+		}
+	}
+
+	SnapshotWriter writer(snapshot.entities);
+	writer.write<uint32_t>(entityHandles.size());
+	writer.write(entityHandles.data(), entityHandles.size() * sizeof(uint32_t));
+	writer.write<int32_t>(nextFreeId);
+	writer.write<int32_t>(lastFreeId);
+
+	std::unique_lock<std::mutex> lock(internedNamesMutex);
+	writeInternedNames(writer, tagIds);
+	lock.unlock();
+	writer.write(entityTags.data(), entityTags.size() * sizeof(int));
+
+	lock.lock();
+	writeInternedNames(writer, groupIds);
+	lock.unlock();
+	writer.write<uint32_t>(entitiesPerGroup.size());
+	for (auto& groupEntities: entitiesPerGroup) {
+		writer.write<uint32_t>(groupEntities.size());
+		for (auto entity: groupEntities) {
+			writer.write<uint32_t>(entity.getHandle());
+		}
+	}
+
+	for (auto& pool: componentPools) {
+		if (!pool || !pool->getSnapshotName()) {
+			continue;
+		}
+
+		// Pages unchanged since the last save or load share their pieces
+		pool->save(currentTick);
+		snapshot.pools.push_back({pool->getSnapshotName(), pool->snapshotPieces});
+	}
+
+	return true;
+}
+
+bool Registry::loadSnapshot(const RegistrySnapshot& snapshot) {
+	if (archetypeStorage) {
+		Logger::error("Registry snapshots need sparse set storage");
+		return false;
+	}
+
+	// Read the whole entity table before touching the registry
+	SnapshotReader reader(snapshot.entities.data(), snapshot.entities.size());
+	uint32_t numEntities = 0;
+	int32_t savedNextFreeId = -1;
+	int32_t savedLastFreeId = -1;
+	std::vector<std::string> tagNames;
+	std::vector<std::string> groupNames;
+	uint32_t numGroups = 0;
+
+	if (!reader.read(numEntities) || numEntities > MAX_ENTITIES || reader.getRemainingSize() / sizeof(uint32_t) < numEntities) {
+		Logger::error("Invalid registry snapshot");
+		return false;
+	}
+
+	std::vector<uint32_t> handles(numEntities);
+	std::vector<int> savedTags(numEntities);
+	reader.read(handles.data(), numEntities * sizeof(uint32_t));
+	reader.read(savedNextFreeId);
+	reader.read(savedLastFreeId);
+	readInternedNames(reader, tagNames);
+	reader.read(savedTags.data(), numEntities * sizeof(int));
+	readInternedNames(reader, groupNames);
+	reader.read(numGroups);
+
+	std::vector<std::vector<uint32_t>> groupHandles;
+	for (uint32_t group = 0; group < numGroups && !reader.hasFailed(); group++) {
+		uint32_t groupSize = 0;
+		reader.read(groupSize);
+
+		if (reader.getRemainingSize() / sizeof(uint32_t) < groupSize) {
+			break;
+		}
+
+		groupHandles.emplace_back(groupSize);
+		reader.read(groupHandles.back().data(), groupSize * sizeof(uint32_t));
+	}
+
+	if (reader.hasFailed() || groupHandles.size() != numGroups || savedNextFreeId >= static_cast<int>(numEntities) || savedLastFreeId >= static_cast<int>(numEntities)) {
+		Logger::error("Invalid registry snapshot");
+		return false;
+	}
+
+	// The current entities leave the systems, the loaded ones join them at the end
+	for (auto& system: systems) {
+		if (system) {
+			system->removeAllEntities();
+		}
+	}
+
+	// Pools that still hold the content of their blob are kept as they are.
+	// Owning groups reorder their pools when they're filled again below.
+	std::vector<IPool*> blobPools;
+	for (auto& blob: snapshot.pools) {
+		const auto poolType = snapshotPoolTypes.find(blob.name);
+		blobPools.push_back(poolType != snapshotPoolTypes.end() ? poolType->second(*this) : nullptr);
+	}
+
+	std::vector<bool> isPoolKept(componentPools.size());
+	for (int blobIndex = 0; blobIndex < static_cast<int>(snapshot.pools.size()); blobIndex++) {
+		IPool* pool = blobPools[blobIndex];
+
+		if (pool && pool->owningGroup == -1 && pool->snapshotPieces == snapshot.pools[blobIndex].pieces && pool->getLastModifiedTick() < pool->snapshotTick) {
+			isPoolKept[pool->getComponentId()] = true;
+		}
+	}
+
+	for (int componentId = 0; componentId < static_cast<int>(componentPools.size()); componentId++) {
+		auto& pool = componentPools[componentId];
+		if (pool && !isPoolKept[componentId]) {
+			pool->clear();
+			pool->snapshotPieces.clear();
+		}
+	}
+
+	for (auto& group: owningGroups) {
+		group->size = 0;
+	}
+
+	entityHandles = std::move(handles);
+	nextFreeId = savedNextFreeId;
+	lastFreeId = savedLastFreeId;
+	entityComponentSignatures.assign(numEntities, Signature());
+	entitySystemSignatures.assign(numEntities, Signature());
+	entityIsInSystems.assign(numEntities, false);
+	entityIsQueuedForRefresh.assign(numEntities, false);
+	entitiesToBeRefreshed.clear();
+	entitiesToBeKilled.clear();
+	entityTags.assign(numEntities, -1);
+
+	// Kills and spawns recorded before the load refer to the replaced entities
+	for (auto& commandBuffer: commandBuffers) {
+		commandBuffer.clear();
+	}
+
+	entityPerTag.clear();
+	entityGroupSignatures.assign(numEntities, GroupSignature());
+	entitiesPerGroup.clear();
+	entityIndexPerGroup.clear();
+
+	bool isValid = true;
+
+	for (int blobIndex = 0; blobIndex < static_cast<int>(snapshot.pools.size()); blobIndex++) {
+		const auto& blob = snapshot.pools[blobIndex];
+		IPool* pool = blobPools[blobIndex];
+
+		if (!pool) {
+			Logger::error("Registry snapshot has components of unknown type " + blob.name);
+			isValid = false;
+			continue;
+		}
+
+		if (!isPoolKept[pool->getComponentId()] && !pool->load(blob.pieces, this)) {
+			Logger::error("Invalid registry snapshot blob for " + blob.name);
+			isValid = false;
+		}
+
+		const int componentId = pool->getComponentId();
+		for (auto entity: pool->getEntities()) {
+			if (entity.getId() < static_cast<int>(numEntities)) {
+				entityComponentSignatures[entity.getId()].set(componentId);
+			}
+		}
+	}
+
+	for (int entityId = 0; entityId < static_cast<int>(numEntities); entityId++) {
+		const int savedTag = savedTags[entityId];
+		Entity entity(entityId, entityHandles[entityId] >> ENTITY_ID_BITS);
+		entity.registry = this;
+
+		if (valid(entity) && savedTag >= 0 && savedTag < static_cast<int>(tagNames.size())) {
+			tagEntity(entity, getTagId(tagNames[savedTag]));
+		}
+	}
+
+	for (int group = 0; group < static_cast<int>(groupHandles.size()) && group < static_cast<int>(groupNames.size()); group++) {
+		const int groupId = getGroupId(groupNames[group]);
+
+		for (auto handle: groupHandles[group]) {
+			const Entity entity(handle & ENTITY_ID_MASK, handle >> ENTITY_ID_BITS);
+			if (valid(entity)) {
+				groupEntity(entity, groupId);
+			}
+		}
+	}
+
+	for (int entityId = 0; entityId < static_cast<int>(numEntities); entityId++) {
+		Entity entity(entityId, entityHandles[entityId] >> ENTITY_ID_BITS);
+		entity.registry = this;
+
+		if (!valid(entity)) {
+			continue;
+		}
+
+		if (!owningGroups.empty()) {
+			addEntityToOwningGroups(entity);
+		}
+
+		entityIsQueuedForRefresh[entityId] = true;
+		entitiesToBeRefreshed.push_back(entity);
+	}
+
+	refreshSystemsInBulk();
+	entitiesToBeRefreshed.clear();
+
+	// Writes after the load get a newer tick than the load itself, so the
+	// pools it left untouched since then keep matching their blobs
+	for (auto& pool: componentPools) {
+		if (pool && !pool->snapshotPieces.empty()) {
+			if (pool->owningGroup == -1) {
+				pool->snapshotTick = currentTick + 1;
+			} else {
+				pool->snapshotPieces.clear();
+			}
+		}
+	}
+	currentTick++;
+
+	Logger::info("Registry snapshot loaded with " + std::to_string(numEntities) + " entity slots");
+	return isValid;
+}
+
+int Registry::getTagId(const std::string& tag) {
+	std::lock_guard<std::mutex> lock(internedNamesMutex);
+	return tagIds.emplace(tag, tagIds.size()).first->second;
+}
+
+int Registry::getGroupId(const std::string& group) {
+	std::lock_guard<std::mutex> lock(internedNamesMutex);
+	const int groupId = groupIds.emplace(group, groupIds.size()).first->second;
+
+	if (groupId >= static_cast<int>(MAX_GROUPS)) {
+		Logger::error("Group " + group + " exceeds the maximum number of groups");
+	}
+
+	return groupId;
+}
+
+int Registry::findTagId(const std::string& tag) {
+	std::lock_guard<std::mutex> lock(internedNamesMutex);
+	auto it = tagIds.find(tag);
+	return it != tagIds.end() ? it->second : -1;
+}
+
+int Registry::findGroupId(const std::string& group) {
+	std::lock_guard<std::mutex> lock(internedNamesMutex);
+	auto it = groupIds.find(group);
+	return it != groupIds.end() ? it->second : -1;
+}
+
+void Registry::tagEntity(Entity entity, const std::string& tag) {
+	tagEntity(entity, getTagId(tag));
+}
+
+void Registry::tagEntity(Entity entity, int tag) {
+	if (tag >= static_cast<int>(entityPerTag.size())) {
+		entityPerTag.resize(tag + 1, Entity(ENTITY_ID_MASK, ENTITY_GENERATION_MASK));
+	}
+
+	// A tag belongs to a single entity, the last one tagged with it
+	const Entity previousEntity = entityPerTag[tag];
+	if (valid(previousEntity) && entityTags[previousEntity.getId()] == tag) {
+		entityTags[previousEntity.getId()] = -1;
+	}
+
+	removeEntityTag(entity);
+
+	entity.registry = this;
+	entityTags[entity.getId()] = tag;
+	entityPerTag[tag] = entity;
+}
+
+bool Registry::entityHasTag(Entity entity, const std::string& tag) const {
+	return entityHasTag(entity, findTagId(tag));
+}
+
+bool Registry::entityHasTag(Entity entity, int tag) const {
+	return tag >= 0 && entityTags[entity.getId()] == tag;
+}
+
+Entity Registry::getEntityByTag(const std::string& tag) const {
+	return getEntityByTag(findTagId(tag));
+}
+
+Entity Registry::getEntityByTag(int tag) const {
+	if (tag < 0 || tag >= static_cast<int>(entityPerTag.size())) {
+		return Entity(ENTITY_ID_MASK, ENTITY_GENERATION_MASK);
+	}
+
+	return entityPerTag[tag];
+}
+
+void Registry::removeEntityTag(Entity entity) {
+	const int tag = entityTags[entity.getId()];
+
+	if (tag != -1) {
+		entityPerTag[tag] = Entity(ENTITY_ID_MASK, ENTITY_GENERATION_MASK);
+		entityTags[entity.getId()] = -1;
+	}
+}
+
+void Registry::groupEntity(Entity entity, const std::string& group) {
+	groupEntity(entity, getGroupId(group));
+}
+
+void Registry::groupEntity(Entity entity, int group) {
+	const int entityId = entity.getId();
+
+	if (group < 0 || group >= static_cast<int>(MAX_GROUPS) || entityGroupSignatures[entityId].test(group)) {
+		return;
+	}
+
+	if (group >= static_cast<int>(entitiesPerGroup.size())) {
+		entitiesPerGroup.resize(group + 1);
+		entityIndexPerGroup.resize(group + 1);
+	}
+
+	auto& entityIndices = entityIndexPerGroup[group];
+	if (entityId >= static_cast<int>(entityIndices.size())) {
+		entityIndices.resize(entityId + 1, -1);
+	}
+
+	entity.registry = this;
+	entityGroupSignatures[entityId].set(group);
+	entityIndices[entityId] = entitiesPerGroup[group].size();
+	entitiesPerGroup[group].push_back(entity);
+}
+
+bool Registry::entityBelongsToGroup(Entity entity, const std::string& group) const {
+	return entityBelongsToGroup(entity, findGroupId(group));
+}
+
+bool Registry::entityBelongsToGroup(Entity entity, int group) const {
+	return group >= 0 && group < static_cast<int>(MAX_GROUPS) && entityGroupSignatures[entity.getId()].test(group);
+}
+
+const std::vector<Entity>& Registry::getEntitiesByGroup(const std::string& group) const {
+	return getEntitiesByGroup(findGroupId(group));
+}
+
+const std::vector<Entity>& Registry::getEntitiesByGroup(int group) const {
+	static const std::vector<Entity> noEntities;
+
+	if (group < 0 || group >= static_cast<int>(entitiesPerGroup.size())) {
+		return noEntities;
+	}
+
+	return entitiesPerGroup[group];
+}
+
+// Removes the entity from every group it belongs to
+void Registry::removeEntityGroup(Entity entity) {
+	const int entityId = entity.getId();
+	auto& groupSignature = entityGroupSignatures[entityId];
+
+	for (int group = 0; groupSignature.any(); group++) {
+		if (!groupSignature.test(group)) {
+			continue;
+		}
+
+		auto& groupEntities = entitiesPerGroup[group];
+		auto& entityIndices = entityIndexPerGroup[group];
+		const int index = entityIndices[entityId];
+
+		groupEntities[index] = groupEntities.back();
+		entityIndices[groupEntities[index].getId()] = index;
+		groupEntities.pop_back();
+		entityIndices[entityId] = -1;
+
+		groupSignature.reset(group);
+	}
+}
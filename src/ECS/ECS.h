@@ -1,22 +1,166 @@
 #ifndef ECS_H
 #define ECS_H
 
+#include <algorithm>
+#include <atomic>
 #include <bitset>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
 #include <vector>
-#include <set>
 #include <unordered_map>
-#include <typeindex>
 #include <memory>
-#include <deque>
+#include <tuple>
+#include <typeinfo>
+#include <type_traits>
 #include <iostream>
 
 #include "../Logger/Logger.h"
+#include "../JobSystem/JobSystem.h"
+
+// Number of component types a signature can hold: 64, 128 or 256
+#ifndef ECS_MAX_COMPONENTS
+#define ECS_MAX_COMPONENTS 64
+#endif
 
 // Constants
-const unsigned int MAX_COMPONENTS = 32;
+const unsigned int MAX_COMPONENTS = ECS_MAX_COMPONENTS;
+const unsigned int MAX_GROUPS = 32;
+
+// Components handled by a parallel chunk should fit in about half of L1
+const size_t PARALLEL_CHUNK_BYTES = 16 * 1024;
+
+// Size of the chunks of the archetype storage
+const size_t ARCHETYPE_CHUNK_BYTES = 16 * 1024;
+
+// How a registry stores its components
+enum StorageMode {
+	// One sparse set pool per component type
+	SPARSE_SET_STORAGE,
+	// Entities with the same signature stored together in chunks
+	ARCHETYPE_STORAGE
+};
+
+// Registry::update() matches the queued entities with the systems in one bulk
+// pass, one system at a time, once at least this many entities are queued
+const size_t BULK_REFRESH_THRESHOLD = 64;
+
+static_assert(MAX_COMPONENTS == 64 || MAX_COMPONENTS == 128 || MAX_COMPONENTS == 256,
+	"ECS_MAX_COMPONENTS must be 64, 128 or 256");
+
+// One bit per component type, stored as plain 64 bit words so arrays of
+// signatures can be matched several at a time with SIMD
+class Signature {
+
+public:
+	static constexpr size_t NUM_WORDS = MAX_COMPONENTS / 64;
+
+private:
+	uint64_t words[NUM_WORDS] = {};
+
+public:
+	bool test(size_t bit) const {
+		assert(bit < MAX_COMPONENTS);
+		return (words[bit / 64] >> (bit % 64)) & 1;
+	}
+
+	Signature& set(size_t bit, bool value = true) {
+		assert(bit < MAX_COMPONENTS);
+		const uint64_t mask = uint64_t(1) << (bit % 64);
+		words[bit / 64] = value ? (words[bit / 64] | mask) : (words[bit / 64] & ~mask);
+		return *this;
+	}
+
+	Signature& reset(size_t bit) {
+		return set(bit, false);
+	}
+
+	Signature& reset() {
+		for (auto& word: words) {
+			word = 0;
+		}
+		return *this;
+	}
+
+	bool any() const {
+		uint64_t bits = 0;
+		for (auto word: words) {
+			bits |= word;
+		}
+		return bits != 0;
+	}
+
+	bool none() const {
+		return !any();
+	}
+
+	// True when every component of other is also in this signature
+	bool contains(const Signature& other) const {
+		uint64_t missing = 0;
+		for (size_t i = 0; i < NUM_WORDS; i++) {
+			missing |= other.words[i] & ~words[i];
+		}
+		return missing == 0;
+	}
+
+	const uint64_t* data() const {
+		return words;
+	}
+
+	Signature operator&(const Signature& other) const {
+		Signature result;
+		for (size_t i = 0; i < NUM_WORDS; i++) {
+			result.words[i] = words[i] & other.words[i];
+		}
+		return result;
+	}
 
-// We use a bitset (0s and 1s)
-typedef std::bitset<MAX_COMPONENTS> Signature;
+	Signature operator|(const Signature& other) const {
+		Signature result;
+		for (size_t i = 0; i < NUM_WORDS; i++) {
+			result.words[i] = words[i] | other.words[i];
+		}
+		return result;
+	}
+
+	bool operator==(const Signature& other) const {
+		uint64_t difference = 0;
+		for (size_t i = 0; i < NUM_WORDS; i++) {
+			difference |= words[i] ^ other.words[i];
+		}
+		return difference == 0;
+	}
+
+	bool operator!=(const Signature& other) const {
+		return !(*this == other);
+	}
+
+};
+
+static_assert(sizeof(Signature) == Signature::NUM_WORDS * sizeof(uint64_t), "Signature arrays must be contiguous words");
+
+namespace std {
+	template <> struct hash<Signature> {
+		size_t operator()(const Signature& signature) const {
+			uint64_t result = 0xcbf29ce484222325ull;
+			for (size_t i = 0; i < Signature::NUM_WORDS; i++) {
+				result = (result ^ signature.data()[i]) * 0x100000001b3ull;
+			}
+			return static_cast<size_t>(result ^ (result >> 32));
+		}
+	};
+}
+
+// Sets matches[i] to whether signatures[i] contains required. Several signatures
+// are tested per instruction with AVX2 or SSE2 when the build targets them
+void matchSignatures(const Signature& required, const Signature* signatures, size_t count, uint8_t* matches);
+
+// Groups an entity belongs to, one bit per interned group id
+typedef std::bitset<MAX_GROUPS> GroupSignature;
 
 // Components
 struct IComponent {
@@ -29,61 +173,124 @@ protected:
 template <typename T> class Component : public IComponent {
 
 public:
+	// A const component shares the id of the component
 	static int getId() {
-		static auto id = nextId++;
-		return id;
+		if constexpr (std::is_const_v<T>) {
+			return Component<std::remove_const_t<T>>::getId();
+		} else {
+			// Ids index the signature bits and the pools of the registry
+			static const int id = []() {
+				if (nextId >= static_cast<int>(MAX_COMPONENTS)) {
+					Logger::error("Maximum number of component types reached, raise ECS_MAX_COMPONENTS");
+					std::abort();
+				}
+				return nextId++;
+			}();
+			return id;
+		}
 	}
 
 };
 
+// Type erased move, copy and destruction of a component, for storages that
+// move components around without knowing their types
+struct ComponentInfo {
+	size_t size;
+	size_t alignment;
+	void (*moveConstruct)(void* destination, void* source);
+	// Constructs count copies of source in a row starting at destination
+	void (*copyConstruct)(void* destination, const void* source, int count);
+	void (*destroy)(void* component);
+
+	template <typename TComponent> static const ComponentInfo* get();
+};
+
 // Entities
+// A handle keeps the entity id in its low bits and the generation of that id in
+// the high bits. The generation is bumped every time the id is recycled, so a
+// handle to a killed entity never aliases the entity that reuses its id.
+const unsigned int ENTITY_ID_BITS = 20;
+const uint32_t ENTITY_ID_MASK = (1u << ENTITY_ID_BITS) - 1;
+const uint32_t ENTITY_GENERATION_MASK = (1u << (32 - ENTITY_ID_BITS)) - 1;
+
+// The last id is never handed out: it ends the free list of ids and stands for
+// "no entity", so a registry holds at most MAX_ENTITIES entities at once
+const uint32_t MAX_ENTITIES = ENTITY_ID_MASK;
+
 class Entity {
 
 private:
-	int id;
+	uint32_t handle;
 
 public:
-	Entity(int id): id(id) {};
+	Entity(int id, int generation = 0):
+		handle(((static_cast<uint32_t>(generation) & ENTITY_GENERATION_MASK) << ENTITY_ID_BITS) | (static_cast<uint32_t>(id) & ENTITY_ID_MASK)) {};
 	int getId() const;
+	int getGeneration() const;
+	uint32_t getHandle() const;
+	bool isValid() const;
 
 	Entity& operator = (const Entity& other) = default;
 
 	bool operator == (const Entity& other) const {
-		return id == other.getId();
+		return handle == other.handle;
 	}
 
 	bool operator != (const Entity& other) const {
-		return id != other.getId();
+		return handle != other.handle;
 	}
 
 	bool operator < (const Entity& other) const {
-		return id < other.getId();
+		return handle < other.handle;
 	}
 
 	bool operator <= (const Entity& other) const {
-		return id <= other.getId();
+		return handle <= other.handle;
 	}
 
 	bool operator > (const Entity& other) const {
-		return id > other.getId();
+		return handle > other.handle;
 	}
 
 	bool operator >= (const Entity& other) const {
-		return id >= other.getId();
+		return handle >= other.handle;
 	}
 
 	template <typename TComponent, typename ...TArgs> void addComponent(TArgs&& ...args);
 	template <typename TComponent> void removeComponent();
 	template <typename TComponent> bool hasComponent() const;
+	// Stamps the change tick unless TComponent is const, see Registry::getComponent()
 	template <typename TComponent> TComponent& getComponent() const;
 	void kill();
 
 	void tag(const std::string& tag);
+	void tag(int tag);
 	bool hasTag(const std::string& tag) const;
+	bool hasTag(int tag) const;
 	void group(const std::string& group);
+	void group(int group);
 	bool belongsToGroup(const std::string& group) const;
+	bool belongsToGroup(int group) const;
 
-	class Registry* registry;
+	class Registry* registry = nullptr;
+
+};
+
+// Dense id per system type, used to index the systems of the registry
+struct ISystemType {
+
+protected:
+	static int nextId;
+
+};
+
+template <typename T> class SystemType : public ISystemType {
+
+public:
+	static int getId() {
+		static auto id = nextId++;
+		return id;
+	}
 
 };
 
@@ -97,109 +304,1487 @@ private:
 	// List of all entities that the system is interested in
 	std::vector<Entity> entities;
 
+	// Index in entities of each entity id, -1 when the system doesn't have it
+	std::vector<int> entityIdToIndex;
+
+	bool isEntityOrderStable = false;
+
+	// Registry tick of the last entity added or removed
+	uint32_t membershipChangeTick = 0;
+
+	// Which components the system reads and writes when it updates, used by the
+	// scheduler to run systems that don't conflict at the same time
+	Signature readSignature;
+	Signature writeSignature;
+
+protected:
+	// Removals keep the entities in the order they were added, at O(n) per removal
+	// instead of the default O(1) swap with the last entity
+	void keepEntityOrder();
+
+	// Component access declarations, including components touched by the event
+	// handlers the system triggers. A system that declares nothing never runs
+	// alongside another one
+	template <typename TComponent> void readsComponent();
+	template <typename TComponent> void writesComponent();
+
 public:
 	System() = default;
 	~System() = default;
 
 	void addEntity(Entity entity);
 	void removeEntity(Entity entity);
-	std::vector<Entity> getEntities() const;
+	void removeAllEntities();
+	const std::vector<Entity>& getEntities() const;
+	uint32_t getMembershipChangeTick() const;
 	const Signature& getComponentSignature() const;
+	const Signature& getReadSignature() const;
+	const Signature& getWriteSignature() const;
+	bool conflictsWith(const System& other) const;
 
 	template <typename TComponent> void requireComponent();
 
+	class Registry* registry = nullptr;
+
 };
 
 // Registry
+// Appends plain values and strings to a snapshot blob
+class SnapshotWriter {
+
+private:
+	std::vector<unsigned char>& bytes;
+
+public:
+	explicit SnapshotWriter(std::vector<unsigned char>& bytes): bytes(bytes) {}
+
+	void write(const void* data, size_t size);
+	void write(const std::string& value);
+	// Entities are written as their handle, without the registry pointer
+	void write(Entity entity);
+
+	// Grows the blob by size bytes, to be filled in by the caller
+	unsigned char* append(size_t size);
+
+	template <typename T> void write(const T& value) {
+		static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values are written as raw bytes");
+		write(&value, sizeof(T));
+	}
+
+};
+
+// Reads back what a SnapshotWriter wrote. Reading past the end fails the reader
+// and leaves the values untouched.
+class SnapshotReader {
+
+private:
+	const unsigned char* bytes;
+	size_t size;
+	size_t offset = 0;
+	bool failed = false;
+	class Registry* registry;
+
+public:
+	SnapshotReader(const unsigned char* bytes, size_t size, class Registry* registry = nullptr):
+		bytes(bytes), size(size), registry(registry) {}
+
+	bool read(void* data, size_t size);
+	bool read(std::string& value);
+	// Entities read back belong to the registry being loaded
+	bool read(Entity& entity);
+
+	template <typename T> bool read(T& value) {
+		static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values are read as raw bytes");
+		return read(&value, sizeof(T));
+	}
+
+	// Bytes at the current offset, which then moves past them. Null when
+	// there aren't that many bytes left.
+	const unsigned char* skip(size_t size);
+
+	size_t getRemainingSize() const;
+	bool hasFailed() const;
+
+};
+
+// Bytes of a snapshot, which may point into a larger buffer they keep alive.
+// Snapshots that share a piece share its bytes.
+struct SnapshotPiece {
+	std::shared_ptr<const unsigned char> bytes;
+	size_t size = 0;
+
+	bool operator == (const SnapshotPiece& other) const {
+		return bytes == other.bytes && size == other.size;
+	}
+};
+
+// Components opt in to snapshots with a name that keys their blob, stable
+// across builds and compilers unlike typeid names:
+//     static constexpr const char* SNAPSHOT_NAME = "Transform";
+// Their bytes are then saved through serialize(SnapshotWriter&, const T&) and
+// deserialize(SnapshotReader&, T&) functions declared next to them, or copied
+// as they are when the component also declares
+//     static constexpr bool SNAPSHOT_AS_BYTES = true;
+// which is only allowed for trivially copyable components without pointers.
+template <typename T, typename = void> struct HasSnapshotSerializer : std::false_type {};
+
+template <typename T> struct HasSnapshotSerializer<T, std::void_t<
+	decltype(serialize(std::declval<SnapshotWriter&>(), std::declval<const T&>())),
+	decltype(deserialize(std::declval<SnapshotReader&>(), std::declval<T&>()))>> : std::true_type {};
+
+template <typename T, typename = void> struct SnapshotName {
+	static constexpr const char* value = nullptr;
+};
+
+template <typename T> struct SnapshotName<T, std::void_t<decltype(T::SNAPSHOT_NAME)>> {
+	static constexpr const char* value = T::SNAPSHOT_NAME;
+};
+
+template <typename T, typename = void> struct IsSnapshotAsBytes : std::false_type {};
+
+template <typename T> struct IsSnapshotAsBytes<T, std::void_t<decltype(T::SNAPSHOT_AS_BYTES)>> : std::bool_constant<T::SNAPSHOT_AS_BYTES> {};
+
 class IPool {
 public:
 	virtual ~IPool() {}
+	virtual void removeEntityFromPool(int entityId) = 0;
+	virtual void clear() = 0;
+	virtual int getComponentId() const = 0;
+
+	// Dense index of the entity's component, -1 when it has none
+	virtual int getIndex(int entityId) const = 0;
+	virtual void swap(int indexA, int indexB) = 0;
+	virtual const std::vector<Entity>& getEntities() const = 0;
+
+	// Owning group that keeps this pool sorted, -1 for none
+	int owningGroup = -1;
+
+	// Snapshot of the pool, keyed by getSnapshotName(), which is null for
+	// components that didn't opt in to snapshots. save() brings snapshotPieces
+	// up to date at the tick. load() replaces the content of the pool, stamps
+	// every loaded component and points snapshotPieces into the loaded pieces.
+	virtual const char* getSnapshotName() const = 0;
+	virtual const char* getTypeName() const = 0;
+	virtual void save(uint32_t tick) = 0;
+	virtual bool load(const std::vector<SnapshotPiece>& pieces, class Registry* registry) = 0;
+
+	// Latest tick a component was written, added, removed or moved at
+	virtual uint32_t getLastModifiedTick() const = 0;
+
+	// Pieces the pool was last saved to or loaded from: the number of
+	// components, then one piece per page. A page not written, added to,
+	// removed from or reordered at or after snapshotTick still matches its
+	// piece, so the following snapshots share it instead of saving it again.
+	std::vector<SnapshotPiece> snapshotPieces;
+	uint32_t snapshotTick = 0;
 
 };
 
-template <typename T> class Pool : public IPool {
+// Sparse set of components: the components are packed in a dense array, with a
+// parallel array of their owners and a sparse entity id -> dense index map.
+// Both the dense components and the sparse map are split in fixed size pages
+// allocated on demand, so growing a pool never moves the components already in
+// it, and slots are only constructed when a component is added.
+//
+// Every slot keeps the registry tick of its last write. Mutable accessors
+// stamp the slot whether or not the caller writes, const accessors don't.
+// Each page and the pool keep the latest tick of their slots, so unchanged
+// pages can be skipped.
+template <typename T> class Pool final : public IPool {
 
 private:
-	std::vector<T> data;
+	static constexpr int PAGE_BITS = 10;
+	static constexpr int PAGE_SIZE = 1 << PAGE_BITS;
+	static constexpr int SPARSE_PAGE_BITS = 12;
+	static constexpr int SPARSE_PAGE_SIZE = 1 << SPARSE_PAGE_BITS;
+
+	struct alignas(T) Page {
+		unsigned char bytes[sizeof(T) * PAGE_SIZE];
+		uint32_t changeTicks[PAGE_SIZE];
+		std::atomic<uint32_t> lastChangeTick{0};
+
+		// Tick of the last removal, swap or clear that moved its components
+		uint32_t lastLayoutTick = 0;
+	};
+
+	// Packed components, without holes between them
+	std::vector<std::unique_ptr<Page>> pages;
+	int size = 0;
+
+	// Entity that owns each component (same index)
+	std::vector<Entity> entities;
+
+	// Index of the component of each entity id, -1 when it has none
+	std::vector<std::unique_ptr<int[]>> sparsePages;
+
+	// Tick of the owning registry, stamped on writes
+	const uint32_t* currentTick = nullptr;
+	std::atomic<uint32_t> lastChangeTick{0};
+
+	// Tick of the last removal, swap or clear, which change the pool without
+	// stamping a slot
+	uint32_t lastLayoutTick = 0;
+
+	T* slot(int index) const {
+		return reinterpret_cast<T*>(pages[index >> PAGE_BITS]->bytes) + (index & (PAGE_SIZE - 1));
+	}
+
+	// Parallel views stamp different slots of the same page from several
+	// threads, the page and pool ticks are only stored when they differ
+	void stamp(int index, uint32_t tick) {
+		Page& page = *pages[index >> PAGE_BITS];
+		page.changeTicks[index & (PAGE_SIZE - 1)] = tick;
+
+		if (page.lastChangeTick.load(std::memory_order_relaxed) < tick) {
+			page.lastChangeTick.store(tick, std::memory_order_relaxed);
+		}
+
+		if (lastChangeTick.load(std::memory_order_relaxed) < tick) {
+			lastChangeTick.store(tick, std::memory_order_relaxed);
+		}
+	}
+
+	void stamp(int index) {
+		stamp(index, currentTick ? *currentTick : 0);
+	}
+
+	int& sparseIndex(int entityId) const {
+		return sparsePages[entityId >> SPARSE_PAGE_BITS][entityId & (SPARSE_PAGE_SIZE - 1)];
+	}
+
+	void assureSparsePage(int entityId) {
+		const int sparsePage = entityId >> SPARSE_PAGE_BITS;
+		if (sparsePage >= static_cast<int>(sparsePages.size())) {
+			sparsePages.resize(sparsePage + 1);
+		}
+
+		if (!sparsePages[sparsePage]) {
+			sparsePages[sparsePage].reset(new int[SPARSE_PAGE_SIZE]);
+			std::fill(sparsePages[sparsePage].get(), sparsePages[sparsePage].get() + SPARSE_PAGE_SIZE, -1);
+		}
+	}
 
 public:
-	Pool(int size = 100) {
-		data.resize(size);
+	Pool() = default;
+	Pool(const Pool&) = delete;
+	Pool& operator = (const Pool&) = delete;
+
+	virtual ~Pool() {
+		clear();
 	}
-	virtual ~Pool() = default;
 
 	bool isEmpty() const {
-		return data.empty();
+		return size == 0;
 	}
 
 	int getSize() const {
-		return data.size();
+		return size;
+	}
+
+	int getComponentId() const override {
+		return Component<T>::getId();
+	}
+
+	void clear() override {
+		for (int i = 0; i < size; i++) {
+			slot(i)->~T();
+		}
+
+		size = 0;
+		entities.clear();
+		sparsePages.clear();
+		lastLayoutTick = currentTick ? *currentTick : 0;
+
+		for (auto& page: pages) {
+			page->lastLayoutTick = lastLayoutTick;
+		}
+	}
+
+	bool has(int entityId) const {
+		const int page = entityId >> SPARSE_PAGE_BITS;
+		return page < static_cast<int>(sparsePages.size()) && sparsePages[page] && sparseIndex(entityId) != -1;
+	}
+
+	// Constructs the component in place, or replaces the one the entity already has
+	template <typename ...TArgs> T& emplace(Entity entity, TArgs&& ...args) {
+		const int entityId = entity.getId();
+
+		if (has(entityId)) {
+			const int index = sparseIndex(entityId);
+			T& component = *slot(index);
+			component = T(std::forward<TArgs>(args)...);
+			stamp(index);
+			return component;
+		}
+
+		assureSparsePage(entityId);
+
+		if ((size >> PAGE_BITS) >= static_cast<int>(pages.size())) {
+			pages.emplace_back(new Page);
+		}
+
+		T* component = new (slot(size)) T(std::forward<TArgs>(args)...);
+		sparseIndex(entityId) = size;
+		entities.push_back(entity);
+		stamp(size);
+		size++;
+
+		return *component;
+	}
+
+	void set(Entity entity, T object) {
+		emplace(entity, std::move(object));
+	}
+
+	static_assert(!SnapshotName<T>::value || IsSnapshotAsBytes<T>::value || HasSnapshotSerializer<T>::value,
+		"Components with a SNAPSHOT_NAME need a serializer or SNAPSHOT_AS_BYTES");
+	static_assert(!IsSnapshotAsBytes<T>::value || std::is_trivially_copyable_v<T>,
+		"Only trivially copyable components can be saved as bytes");
+
+	const char* getSnapshotName() const override {
+		return SnapshotName<T>::value;
+	}
+
+	// Only for messages, it differs between compilers
+	const char* getTypeName() const override {
+		return typeid(T).name();
+	}
+
+	// The first piece holds the number of components. Each page then has a
+	// piece with the handles of its entities followed by its components,
+	// copied as they are or written through their serializer. Pages that
+	// didn't change since the last save or load keep their piece, the others
+	// are saved into a single new buffer.
+	void save(uint32_t tick) override {
+		if (!snapshotPieces.empty() && getLastModifiedTick() < snapshotTick) {
+			return;
+		}
+
+		int32_t savedCount = -1;
+		if (!snapshotPieces.empty()) {
+			std::memcpy(&savedCount, snapshotPieces[0].bytes.get(), sizeof(int32_t));
+		}
+
+		const int numPages = (size + PAGE_SIZE - 1) >> PAGE_BITS;
+		snapshotPieces.resize(numPages + 1);
+
+		// Piece indices to save, the count is piece 0 and page p is piece p + 1
+		std::vector<int> savedPieces;
+		if (savedCount != size) {
+			savedPieces.push_back(0);
+		}
+
+		for (int page = 0; page < numPages; page++) {
+			const int run = std::min(PAGE_SIZE, size - page * PAGE_SIZE);
+			const int savedRun = std::min(PAGE_SIZE, std::max(savedCount - page * PAGE_SIZE, 0));
+			const Page& source = *pages[page];
+
+			const bool isUnchanged = snapshotPieces[page + 1].bytes && run == savedRun &&
+				source.lastChangeTick.load(std::memory_order_relaxed) < snapshotTick && source.lastLayoutTick < snapshotTick;
+
+			if (!isUnchanged) {
+				savedPieces.push_back(page + 1);
+			}
+		}
+
+		auto bytes = std::make_shared<std::vector<unsigned char>>();
+		SnapshotWriter writer(*bytes);
+		if constexpr (IsSnapshotAsBytes<T>::value) {
+			bytes->reserve(sizeof(int32_t) + savedPieces.size() * PAGE_SIZE * (sizeof(uint32_t) + sizeof(T)));
+		}
+
+		std::vector<size_t> offsets;
+		for (auto piece: savedPieces) {
+			offsets.push_back(bytes->size());
+
+			if (piece == 0) {
+				writer.write<int32_t>(size);
+				continue;
+			}
+
+			const int begin = (piece - 1) * PAGE_SIZE;
+			const int run = std::min(PAGE_SIZE, size - begin);
+
+			unsigned char* handles = writer.append(run * sizeof(uint32_t));
+			for (int index = 0; index < run; index++) {
+				const uint32_t handle = entities[begin + index].getHandle();
+				std::memcpy(handles + index * sizeof(uint32_t), &handle, sizeof(uint32_t));
+			}
+
+			if constexpr (IsSnapshotAsBytes<T>::value) {
+				writer.write(slot(begin), sizeof(T) * run);
+			} else if constexpr (HasSnapshotSerializer<T>::value) {
+				for (int index = begin; index < begin + run; index++) {
+					serialize(writer, *slot(index));
+				}
+			}
+		}
+		offsets.push_back(bytes->size());
+
+		// The pieces point into the buffer once it stopped growing
+		for (size_t i = 0; i < savedPieces.size(); i++) {
+			snapshotPieces[savedPieces[i]] = {std::shared_ptr<const unsigned char>(bytes, bytes->data() + offsets[i]), offsets[i + 1] - offsets[i]};
+		}
+
+		snapshotTick = tick;
+	}
+
+	// The pieces are read in order as a single stream, as long as no page is
+	// split between two of them. A snapshot read from a file has one piece.
+	bool load(const std::vector<SnapshotPiece>& pieces, class Registry* registry) override {
+		clear();
+		snapshotPieces.clear();
+
+		if constexpr (!IsSnapshotAsBytes<T>::value && !HasSnapshotSerializer<T>::value) {
+			return false;
+		}
+
+		if (pieces.empty()) {
+			return false;
+		}
+
+		size_t totalSize = 0;
+		for (auto& piece: pieces) {
+			totalSize += piece.size;
+		}
+
+		size_t pieceIndex = 0;
+		SnapshotReader reader(pieces[0].bytes.get(), pieces[0].size, registry);
+
+		// Start of the next page, in the next piece once the current one is read
+		auto beginPage = [&]() {
+			while (reader.getRemainingSize() == 0 && pieceIndex + 1 < pieces.size()) {
+				pieceIndex++;
+				reader = SnapshotReader(pieces[pieceIndex].bytes.get(), pieces[pieceIndex].size, registry);
+			}
+			return reader.skip(0);
+		};
+
+		// The bytes read since begin, kept alive by the piece they're in
+		auto endPage = [&](const unsigned char* begin) {
+			snapshotPieces.push_back({std::shared_ptr<const unsigned char>(pieces[pieceIndex].bytes, begin), static_cast<size_t>(reader.skip(0) - begin)});
+		};
+
+		const unsigned char* countBytes = beginPage();
+		int32_t count = 0;
+		if (!reader.read(count) || count < 0 || totalSize / sizeof(uint32_t) < static_cast<size_t>(count)) {
+			snapshotPieces.clear();
+			return false;
+		}
+		endPage(countBytes);
+
+		const uint32_t tick = currentTick ? *currentTick : 0;
+		entities.reserve(count);
+
+		while (size < count) {
+			const int run = std::min(count - size, PAGE_SIZE);
+			const unsigned char* pageBytes = beginPage();
+			const unsigned char* handles = reader.skip(static_cast<size_t>(run) * sizeof(uint32_t));
+
+			if (!handles) {
+				break;
+			}
+
+			if constexpr (IsSnapshotAsBytes<T>::value) {
+				if (reader.getRemainingSize() < sizeof(T) * run) {
+					break;
+				}
+			}
+
+			for (int index = 0; index < run; index++) {
+				uint32_t handle;
+				std::memcpy(&handle, handles + index * sizeof(uint32_t), sizeof(uint32_t));
+
+				Entity entity(handle & ENTITY_ID_MASK, handle >> ENTITY_ID_BITS);
+				entity.registry = registry;
+				assureSparsePage(entity.getId());
+				sparseIndex(entity.getId()) = size + index;
+				entities.push_back(entity);
+			}
+
+			if ((size >> PAGE_BITS) >= static_cast<int>(pages.size())) {
+				pages.emplace_back(new Page);
+			}
+
+			Page& page = *pages[size >> PAGE_BITS];
+
+			if constexpr (IsSnapshotAsBytes<T>::value) {
+				std::memcpy(slot(size), reader.skip(sizeof(T) * run), sizeof(T) * run);
+			} else if constexpr (HasSnapshotSerializer<T>::value) {
+				// Components stay default constructed if the blob is cut short
+				for (int index = size; index < size + run; index++) {
+					deserialize(reader, *new (slot(index)) T());
+				}
+			}
+
+			std::fill_n(page.changeTicks, run, tick);
+			page.lastChangeTick.store(tick, std::memory_order_relaxed);
+			size += run;
+
+			if (reader.hasFailed()) {
+				break;
+			}
+			endPage(pageBytes);
+		}
+
+		lastChangeTick.store(tick, std::memory_order_relaxed);
+
+		// The pool is left empty rather than half loaded
+		if (size < count || reader.hasFailed()) {
+			clear();
+			snapshotPieces.clear();
+			return false;
+		}
+
+		return true;
+	}
+
+	// Appends a copy of value for each of the entities, which must not have the
+	// component yet. The copies are filled a page at a time.
+	void emplaceCopies(const Entity* newEntities, int count, const T& value) {
+		const uint32_t tick = currentTick ? *currentTick : 0;
+		entities.insert(entities.end(), newEntities, newEntities + count);
+
+		for (int i = 0; i < count; i++) {
+			assureSparsePage(newEntities[i].getId());
+			sparseIndex(newEntities[i].getId()) = size + i;
+		}
+
+		while (count > 0) {
+			if ((size >> PAGE_BITS) >= static_cast<int>(pages.size())) {
+				pages.emplace_back(new Page);
+			}
+
+			const int pageOffset = size & (PAGE_SIZE - 1);
+			const int run = std::min(count, PAGE_SIZE - pageOffset);
+			Page& page = *pages[size >> PAGE_BITS];
+
+			std::uninitialized_fill_n(slot(size), run, value);
+			std::fill_n(page.changeTicks + pageOffset, run, tick);
+
+			if (page.lastChangeTick.load(std::memory_order_relaxed) < tick) {
+				page.lastChangeTick.store(tick, std::memory_order_relaxed);
+			}
+
+			size += run;
+			count -= run;
+		}
+
+		if (lastChangeTick.load(std::memory_order_relaxed) < tick) {
+			lastChangeTick.store(tick, std::memory_order_relaxed);
+		}
+	}
+
+	// Moves the last component into the hole so the components stay packed
+	void remove(int entityId) {
+		if (!has(entityId)) {
+			return;
+		}
+
+		const int index = sparseIndex(entityId);
+		const int lastIndex = size - 1;
+
+		if (index != lastIndex) {
+			// The moved component keeps its tick, it didn't change
+			*slot(index) = std::move(*slot(lastIndex));
+			entities[index] = entities[lastIndex];
+			sparseIndex(entities[index].getId()) = index;
+			stamp(index, getChangeTickAt(lastIndex));
+		}
+
+		slot(lastIndex)->~T();
+		entities.pop_back();
+		sparseIndex(entityId) = -1;
+		size--;
+		lastLayoutTick = currentTick ? *currentTick : 0;
+		pages[index >> PAGE_BITS]->lastLayoutTick = lastLayoutTick;
+		pages[lastIndex >> PAGE_BITS]->lastLayoutTick = lastLayoutTick;
 	}
 
-	void resize(int size) {
-		data.resize(size);
+	void removeEntityFromPool(int entityId) override {
+		remove(entityId);
 	}
 
-	void clear() {
-		data.clear();
+	int getIndex(int entityId) const override {
+		return has(entityId) ? sparseIndex(entityId) : -1;
 	}
 
-	void add(T object) {
-		data.push_back(object);
+	// Swaps two components with their owners, the components keep their ticks
+	void swap(int indexA, int indexB) override {
+		if (indexA == indexB) {
+			return;
+		}
+
+		const uint32_t tickA = getChangeTickAt(indexA);
+		const uint32_t tickB = getChangeTickAt(indexB);
+
+		std::swap(*slot(indexA), *slot(indexB));
+		std::swap(entities[indexA], entities[indexB]);
+		sparseIndex(entities[indexA].getId()) = indexA;
+		sparseIndex(entities[indexB].getId()) = indexB;
+
+		stamp(indexA, tickB);
+		stamp(indexB, tickA);
+		lastLayoutTick = currentTick ? *currentTick : 0;
+		pages[indexA >> PAGE_BITS]->lastLayoutTick = lastLayoutTick;
+		pages[indexB >> PAGE_BITS]->lastLayoutTick = lastLayoutTick;
 	}
 
-	void set(int index, T object) {
-		data[index] = object;
+	T& get(int entityId) {
+		const int index = sparseIndex(entityId);
+		stamp(index);
+		return *slot(index);
 	}
 
-	T& get(int index) {
-		return static_cast<T&>(data[index]);
+	const T& get(int entityId) const {
+		return *slot(sparseIndex(entityId));
 	}
 
+	// Dense access, index goes from 0 to getSize() - 1
 	T& operator [](unsigned int index) {
-		return data[index];
+		stamp(index);
+		return *slot(index);
+	}
+
+	const T& operator [](unsigned int index) const {
+		return *slot(index);
+	}
+
+	void setTickSource(const uint32_t* currentTick) {
+		this->currentTick = currentTick;
+	}
+
+	uint32_t getChangeTickAt(int index) const {
+		return pages[index >> PAGE_BITS]->changeTicks[index & (PAGE_SIZE - 1)];
+	}
+
+	uint32_t getChangeTick(int entityId) const {
+		return getChangeTickAt(sparseIndex(entityId));
+	}
+
+	bool isChangedSince(int entityId, uint32_t tick) const {
+		return getChangeTick(entityId) >= tick;
+	}
+
+	uint32_t getLastChangeTick() const {
+		return lastChangeTick.load(std::memory_order_relaxed);
+	}
+
+	uint32_t getLastModifiedTick() const override {
+		return std::max(getLastChangeTick(), lastLayoutTick);
+	}
+
+	// Calls function(index) for the dense index of every component written at
+	// or after the tick, skipping the pages with no such component
+	template <typename TFunction> void forEachChangedSince(uint32_t tick, TFunction&& function) const {
+		if (getLastChangeTick() < tick) {
+			return;
+		}
+
+		for (int page = 0; page * PAGE_SIZE < size; page++) {
+			if (pages[page]->lastChangeTick.load(std::memory_order_relaxed) < tick) {
+				continue;
+			}
+
+			const int end = std::min(size, (page + 1) * PAGE_SIZE);
+			for (int index = page * PAGE_SIZE; index < end; index++) {
+				if (pages[page]->changeTicks[index & (PAGE_SIZE - 1)] >= tick) {
+					function(index);
+				}
+			}
+		}
+	}
+
+	Entity getEntity(unsigned int index) const {
+		return entities[index];
+	}
+
+	const std::vector<Entity>& getEntities() const override {
+		return entities;
+	}
+
+	// Components of one chunk of a view or group, used by a single thread. The
+	// sparse and dense pages of the last component are kept for the next one,
+	// and a written page is stamped once each time the chunk moves to it rather
+	// than for every component. The pool is stamped once, when the access ends.
+	class ChunkAccess {
+
+	private:
+		Pool& pool;
+		const uint32_t tick;
+
+		int sparsePage = -1;
+		const int* sparse = nullptr;
+
+		int page = -1;
+		Page* pagePointer = nullptr;
+		int stampedPage = -1;
+
+		Page& resolvePage(int index) {
+			if ((index >> PAGE_BITS) != page) {
+				page = index >> PAGE_BITS;
+				pagePointer = pool.pages[page].get();
+			}
+			return *pagePointer;
+		}
+
+	public:
+		explicit ChunkAccess(Pool& pool): pool(pool), tick(pool.currentTick ? *pool.currentTick : 0) {}
+
+		ChunkAccess(const ChunkAccess&) = delete;
+		ChunkAccess& operator = (const ChunkAccess&) = delete;
+
+		~ChunkAccess() {
+			if (stampedPage != -1 && pool.lastChangeTick.load(std::memory_order_relaxed) < tick) {
+				pool.lastChangeTick.store(tick, std::memory_order_relaxed);
+			}
+		}
+
+		// Dense index of the component of the entity, -1 when it has none
+		int find(int entityId) {
+			if ((entityId >> SPARSE_PAGE_BITS) != sparsePage) {
+				sparsePage = entityId >> SPARSE_PAGE_BITS;
+				sparse = sparsePage < static_cast<int>(pool.sparsePages.size()) ? pool.sparsePages[sparsePage].get() : nullptr;
+			}
+			return sparse ? sparse[entityId & (SPARSE_PAGE_SIZE - 1)] : -1;
+		}
+
+		const T& read(int index) {
+			return reinterpret_cast<const T*>(resolvePage(index).bytes)[index & (PAGE_SIZE - 1)];
+		}
+
+		T& write(int index) {
+			Page& written = resolvePage(index);
+			written.changeTicks[index & (PAGE_SIZE - 1)] = tick;
+
+			if (page != stampedPage) {
+				stampedPage = page;
+				if (written.lastChangeTick.load(std::memory_order_relaxed) < tick) {
+					written.lastChangeTick.store(tick, std::memory_order_relaxed);
+				}
+			}
+
+			return reinterpret_cast<T*>(written.bytes)[index & (PAGE_SIZE - 1)];
+		}
+
+	};
+
+};
+
+// Const components of a view or group are read without stamping them
+template <typename TComponent, typename TAccess> TComponent& accessChunkComponent(TAccess& access, int index) {
+	if constexpr (std::is_const_v<TComponent>) {
+		return access.read(index);
+	} else {
+		return access.write(index);
 	}
+}
+
+// Fixed size block of an archetype: the entities, then one array per component
+struct ArchetypeChunk {
+	alignas(64) unsigned char bytes[ARCHETYPE_CHUNK_BYTES];
+
+	// Registry tick of the last write to each component array, by component id
+	std::atomic<uint32_t> changeTicks[MAX_COMPONENTS];
+};
+
+// Entities that have exactly the same components. The entities fill the
+// chunks in order, so every chunk but the last one is full.
+class Archetype {
+
+private:
+	// Offset of each component array in a chunk, by component id
+	size_t columnOffsets[MAX_COMPONENTS];
+	const ComponentInfo* componentInfos[MAX_COMPONENTS];
+
+public:
+	Signature signature;
+	std::vector<int> componentIds;
+	int chunkCapacity = 0;
+	int size = 0;
+	std::vector<std::unique_ptr<ArchetypeChunk>> chunks;
+
+	// Archetypes with one more or one less component, by component id, -1 until used
+	int addEdges[MAX_COMPONENTS];
+	int removeEdges[MAX_COMPONENTS];
+
+	Archetype(const Signature& signature, const ComponentInfo* const* componentInfos);
+
+	int getChunkSize(int chunk) const;
+	Entity* getEntities(int chunk) const;
+	void* getComponent(int row, int componentId) const;
+	const ComponentInfo& getComponentInfo(int componentId) const;
+
+	template <typename TComponent> TComponent* getColumn(int chunk) const;
+
+	void stamp(int chunk, int componentId, uint32_t tick);
+
+};
+
+// Component storage where entities with the same signature live together in
+// chunks, with one array per component in each chunk. Adding or removing a
+// component moves the entity to another archetype. Change ticks are tracked
+// per chunk and per component.
+class ArchetypeStorage {
+
+private:
+	struct EntityLocation {
+		int archetype;
+		int row;
+	};
+
+	std::vector<std::unique_ptr<Archetype>> archetypes;
+	std::unordered_map<Signature, int> archetypeIndices;
+	std::vector<EntityLocation> entityLocations;
+	const ComponentInfo* componentInfos[MAX_COMPONENTS] = {};
+	const uint32_t* currentTick;
+
+	int getArchetype(const Signature& signature);
+	void assureChunk(Archetype& archetype, int chunk);
+	int appendRow(Archetype& archetype, Entity entity);
+	void removeRow(int archetypeIndex, int row);
+
+	// Moves the entity to the archetype with its components, leaving the
+	// components the source archetype doesn't have unconstructed
+	int moveEntity(Entity entity, int targetArchetype);
+
+	EntityLocation& getLocation(int entityId);
+
+public:
+	ArchetypeStorage(const uint32_t* currentTick);
+	~ArchetypeStorage();
+
+	ArchetypeStorage(const ArchetypeStorage&) = delete;
+	ArchetypeStorage& operator = (const ArchetypeStorage&) = delete;
+
+	template <typename TComponent, typename ...TArgs> void emplace(Entity entity, TArgs&& ...args);
+	void remove(Entity entity, int componentId);
+	void removeEntity(Entity entity);
+
+	// Adds entities without components to the archetype of signature, copying
+	// values[componentId] into every row a chunk at a time
+	void instantiate(const Signature& signature, const Entity* entities, int count,
+		const void* const* values, const ComponentInfo* const* infos);
+
+	// Const components are read without stamping the change tick
+	template <typename TComponent> TComponent& get(int entityId);
+
+	template <typename TComponent, typename TFunction> void forEachChangedSince(uint32_t tick, TFunction&& function) const;
+
+	// Tick of the chunk that holds the entity's component
+	uint32_t getChangeTick(int entityId, int componentId) const;
+
+	const std::vector<std::unique_ptr<Archetype>>& getArchetypes() const;
+	uint32_t getCurrentTick() const;
+
+};
+
+// While a scope is alive, components added on its thread are recorded in the
+// thread's command buffer instead of being added right away. Killing entities
+// and removing components are always deferred.
+class DeferredChangesScope {
+
+private:
+	bool wasDeferring;
+
+public:
+	DeferredChangesScope();
+	~DeferredChangesScope();
+
+	static bool isActive();
 
 };
 
+// View over the entities that have all the TComponents. The pools are resolved
+// once when the view is created, and each() hands out references to the
+// components without copying the entity list. Components listed as const are
+// read without marking them as changed.
+//
+// A view goes by the components the entities have right now, not by the
+// entities of any system: entities created or given components since the last
+// Registry::update() are already in the view, while the systems only get them
+// at that update.
+template <typename ...TComponents> class View {
+
+private:
+	std::tuple<Pool<std::remove_const_t<TComponents>>*...> pools;
+	JobSystem* jobSystem;
+
+	// Set instead of the pools when the registry uses archetype storage
+	ArchetypeStorage* archetypeStorage;
+
+	bool hasAllPools() const {
+		return (std::get<Pool<std::remove_const_t<TComponents>>*>(pools) && ...);
+	}
+
+	// Iterating the smallest pool visits the fewest candidates
+	const std::vector<Entity>& getSmallestEntities() const {
+		const std::vector<Entity>* entities = nullptr;
+		((entities = (!entities || std::get<Pool<std::remove_const_t<TComponents>>*>(pools)->getEntities().size() < entities->size())
+			? &std::get<Pool<std::remove_const_t<TComponents>>*>(pools)->getEntities()
+			: entities), ...);
+		return *entities;
+	}
+
+	bool matches(const Archetype& archetype) const {
+		return (archetype.signature.test(Component<TComponents>::getId()) && ...);
+	}
+
+	// The written component arrays are stamped once for the whole chunk
+	template <typename TFunction> void eachInChunk(Archetype& archetype, int chunk, TFunction& function) {
+		const uint32_t tick = archetypeStorage->getCurrentTick();
+		((std::is_const_v<TComponents> ? (void)0 : archetype.stamp(chunk, Component<TComponents>::getId(), tick)), ...);
+
+		const int chunkSize = archetype.getChunkSize(chunk);
+		const Entity* entities = archetype.getEntities(chunk);
+		std::tuple<TComponents*...> columns(archetype.template getColumn<TComponents>(chunk)...);
+
+		for (int i = 0; i < chunkSize; i++) {
+			function(entities[i], std::get<TComponents*>(columns)[i]...);
+		}
+	}
+
+	// The pool whose entities are iterated has the component at the dense index
+	// already, the other pools go through their sparse map
+	template <typename TFunction, size_t ...I> void eachInRange(const std::vector<Entity>& entities, int begin, int end, TFunction& function, std::index_sequence<I...>) {
+		std::tuple<typename Pool<std::remove_const_t<TComponents>>::ChunkAccess...> accesses(*std::get<I>(pools)...);
+		const bool isIterated[] = {&std::get<I>(pools)->getEntities() == &entities...};
+
+		for (int i = begin; i < end && i < static_cast<int>(entities.size()); i++) {
+			const Entity entity = entities[i];
+			const int indices[] = {isIterated[I] ? i : std::get<I>(accesses).find(entity.getId())...};
+
+			if (((indices[I] < 0) || ...)) {
+				continue;
+			}
+
+			function(entity, accessChunkComponent<TComponents>(std::get<I>(accesses), indices[I])...);
+		}
+	}
+
+	template <typename TFunction> void eachInRange(const std::vector<Entity>& entities, int begin, int end, TFunction& function) {
+		eachInRange(entities, begin, end, function, std::index_sequence_for<TComponents...>());
+	}
+
+public:
+	View(JobSystem* jobSystem, ArchetypeStorage* archetypeStorage, Pool<std::remove_const_t<TComponents>>* ...pools):
+		pools(pools...), jobSystem(jobSystem), archetypeStorage(archetypeStorage) {}
+
+	// Calls function(Entity, TComponents&...) for each entity in the view.
+	// Entities created while iterating are left for the next run. Components
+	// added while iterating are deferred to the next registry update in both
+	// storage modes, since adding one may move the entity or grow a pool.
+	template <typename TFunction> void each(TFunction&& function) {
+		DeferredChangesScope deferredChanges;
+
+		if (archetypeStorage) {
+			for (auto& archetype: archetypeStorage->getArchetypes()) {
+				if (!matches(*archetype)) {
+					continue;
+				}
+
+				for (int chunk = 0; chunk * archetype->chunkCapacity < archetype->size; chunk++) {
+					eachInChunk(*archetype, chunk, function);
+				}
+			}
+			return;
+		}
+
+		if (!hasAllPools()) {
+			return;
+		}
+
+		const auto& entities = getSmallestEntities();
+		eachInRange(entities, 0, entities.size(), function);
+	}
+
+	// Same as each(), with the entities split in cache sized chunks that run on
+	// the job system. The function runs concurrently for different entities, so
+	// it may only touch the components it is given; components added inside
+	// it are deferred to the next registry update. Runs serially when the
+	// registry has no job system.
+	template <typename TFunction> void parallelEach(TFunction&& function) {
+		if (archetypeStorage) {
+			if (!jobSystem) {
+				each(function);
+				return;
+			}
+
+			// Chunks are already cache sized, one job per chunk
+			std::vector<std::pair<Archetype*, int>> chunks;
+			for (auto& archetype: archetypeStorage->getArchetypes()) {
+				if (!matches(*archetype)) {
+					continue;
+				}
+
+				for (int chunk = 0; chunk * archetype->chunkCapacity < archetype->size; chunk++) {
+					chunks.emplace_back(archetype.get(), chunk);
+				}
+			}
+
+			jobSystem->parallelFor(0, chunks.size(), [&](int begin, int end) {
+				DeferredChangesScope deferredChanges;
+				for (int i = begin; i < end; i++) {
+					eachInChunk(*chunks[i].first, chunks[i].second, function);
+				}
+			});
+			return;
+		}
+
+		if (!hasAllPools()) {
+			return;
+		}
+
+		const auto& entities = getSmallestEntities();
+		const int size = entities.size();
+
+		if (!jobSystem) {
+			DeferredChangesScope deferredChanges;
+			eachInRange(entities, 0, size, function);
+			return;
+		}
+
+		const int chunkSize = std::max<int>(1, PARALLEL_CHUNK_BYTES / (sizeof(Entity) + (sizeof(TComponents) + ...)));
+
+		jobSystem->parallelFor(0, size, [&](int begin, int end) {
+			DeferredChangesScope deferredChanges;
+			eachInRange(entities, begin, end, function);
+		}, chunkSize);
+	}
+
+};
+
+// Group of components whose pools are kept sorted by the registry: the first
+// getSize() components of every owned pool belong to the group's entities, in
+// the same order. Iterating a group is a linear walk over parallel arrays,
+// without any sparse lookup. A pool can be owned by a single group.
+template <typename ...TComponents> class OwningGroup {
+
+private:
+	std::tuple<Pool<std::remove_const_t<TComponents>>*...> pools;
+	const int* size;
+	JobSystem* jobSystem;
+
+	template <typename TFunction, size_t ...I> void eachInRange(int begin, int end, TFunction& function, std::index_sequence<I...>) {
+		if (begin >= end) {
+			return;
+		}
+
+		std::tuple<typename Pool<std::remove_const_t<TComponents>>::ChunkAccess...> accesses(*std::get<I>(pools)...);
+		const auto& entities = std::get<0>(pools)->getEntities();
+
+		for (int i = begin; i < end; i++) {
+			function(entities[i], accessChunkComponent<TComponents>(std::get<I>(accesses), i)...);
+		}
+	}
+
+	template <typename TFunction> void eachInRange(int begin, int end, TFunction& function) {
+		eachInRange(begin, end, function, std::index_sequence_for<TComponents...>());
+	}
+
+public:
+	OwningGroup(JobSystem* jobSystem, const int* size, Pool<std::remove_const_t<TComponents>>* ...pools): pools(pools...), size(size), jobSystem(jobSystem) {}
+
+	int getSize() const {
+		return *size;
+	}
+
+	// Calls function(Entity, TComponents&...) for each entity in the group
+	template <typename TFunction> void each(TFunction&& function) {
+		eachInRange(0, *size, function);
+	}
+
+	// Same as View::parallelEach
+	template <typename TFunction> void parallelEach(TFunction&& function) {
+		const int groupSize = *size;
+
+		if (!jobSystem) {
+			DeferredChangesScope deferredChanges;
+			eachInRange(0, groupSize, function);
+			return;
+		}
+
+		const int chunkSize = std::max<int>(1, PARALLEL_CHUNK_BYTES / (sizeof(Entity) + (sizeof(TComponents) + ...)));
+
+		jobSystem->parallelFor(0, groupSize, [&](int begin, int end) {
+			DeferredChangesScope deferredChanges;
+			eachInRange(begin, end, function);
+		}, chunkSize);
+	}
+
+};
+
+// Fixed list of systems resolved once from a registry. Every system is reached
+// through its concrete type at a compile time index, and forEach calls them in
+// the order of the list, without lookups or virtual calls.
+template <typename ...TSystems> class SystemPipeline {
+
+private:
+	std::tuple<TSystems*...> systems;
+
+public:
+	explicit SystemPipeline(class Registry& registry);
+
+	template <typename TSystem> TSystem& get() const {
+		return *std::get<TSystem*>(systems);
+	}
+
+	// Calls function(TSystem&) for each system, in order
+	template <typename TFunction> void forEach(TFunction&& function) const {
+		(function(*std::get<TSystems*>(systems)), ...);
+	}
+
+};
+
+// Component set with default values, registered once by name and instantiated
+// many times. Each component type is copied into its storage in one pass for
+// all the new entities, see Registry::instantiate().
+class Prefab {
+
+private:
+	struct PrefabComponent {
+		int componentId;
+		std::shared_ptr<void> value;
+		const ComponentInfo* info;
+		// Appends copies of value to the sparse set pool of the component
+		void (*instantiate)(class Registry& registry, const void* value, const Entity* entities, int count);
+	};
+
+	std::string name;
+	Signature signature;
+	std::vector<PrefabComponent> components;
+	GroupSignature groups;
+
+	friend class Registry;
+
+public:
+	explicit Prefab(const std::string& name);
+
+	const std::string& getName() const;
+	const Signature& getSignature() const;
+
+	// Sets the default value of a component, replacing the previous one
+	template <typename TComponent, typename ...TArgs> Prefab& addComponent(TArgs&& ...args);
+
+	// Takes an interned id, see Registry::getGroupId()
+	Prefab& group(int group);
+
+};
+
+// Placeholder for an entity created through a CommandBuffer, it becomes a real
+// entity when the buffer is applied
+struct PendingEntity {
+	int index;
+};
+
+// Structural changes (create, kill, add and remove component) recorded by a
+// single thread and applied in bulk by Registry::update(). Every thread writes
+// only to its own buffer, so recording needs no locks.
+class CommandBuffer {
+
+private:
+	struct Command {
+		// A null apply function means "create an entity", from a prefab when the
+		// payload is an InstantiatePayload
+		void (*apply)(class Registry& registry, Entity entity, void* payload);
+		void (*destroy)(void* payload);
+		Entity entity;
+		int pendingIndex;
+		void* payload;
+	};
+
+	std::vector<Command> commands;
+
+	// Payloads are placed in fixed size blocks that are reused between frames,
+	// so recorded components never move and steady state recording doesn't allocate
+	static constexpr size_t BLOCK_SIZE = 16 * 1024;
+	std::vector<std::unique_ptr<unsigned char[]>> blocks;
+	std::vector<size_t> blockSizes;
+	size_t currentBlock = 0;
+	size_t currentOffset = 0;
+
+	int numPendingEntities = 0;
+	std::vector<Entity> createdEntities;
+
+	void* allocate(size_t size, size_t alignment);
+	void record(void (*apply)(class Registry&, Entity, void*), void (*destroy)(void*), Entity entity, int pendingIndex, void* payload);
+
+	template <typename TPayload, typename ...TArgs> void* createPayload(TArgs&& ...args);
+	template <typename TComponent> static void applyAddComponent(class Registry& registry, Entity entity, void* payload);
+	template <typename TComponent> static void applyRemoveComponent(class Registry& registry, Entity entity, void* payload);
+	template <typename TPayload> static void destroyPayload(void* payload);
+	static void applyKillEntity(class Registry& registry, Entity entity, void* payload);
+	static void applyGroupEntity(class Registry& registry, Entity entity, void* payload);
+	static void applyTagEntity(class Registry& registry, Entity entity, void* payload);
+
+	struct InstantiatePayload {
+		const Prefab* prefab;
+		int count;
+	};
+
+
+public:
+	CommandBuffer() = default;
+	CommandBuffer(const CommandBuffer&) = delete;
+	CommandBuffer& operator = (const CommandBuffer&) = delete;
+	~CommandBuffer();
+
+	PendingEntity createEntity();
+	void killEntity(Entity entity);
+
+	// Records the creation of count entities from the prefab, which must outlive
+	// the buffer. Returns the first of count consecutive pending entities.
+	PendingEntity instantiate(const Prefab& prefab, int count);
+
+	template <typename TComponent, typename ...TArgs> void addComponent(Entity entity, TArgs&& ...args);
+	template <typename TComponent, typename ...TArgs> void addComponent(PendingEntity entity, TArgs&& ...args);
+	template <typename TComponent> void removeComponent(Entity entity);
+
+	// Tags and groups take interned ids, see Registry::getTagId() and getGroupId()
+	void tagEntity(PendingEntity entity, int tag);
+	void groupEntity(PendingEntity entity, int group);
+
+	bool isEmpty() const;
+
+	// Replays the commands in the order they were recorded, then resets the buffer
+	void apply(class Registry& registry);
+
+	// Drops the commands without applying them
+	void clear();
+
+};
+
+// Saved state of a registry: the entity table with the tags and groups, and a
+// blob per component pool keyed by the SNAPSHOT_NAME of the component, in
+// pieces that later snapshots can share (see IPool). Signatures aren't saved, they're rebuilt from the pools on load since component ids
+// depend on the order the types are first used in.
+struct RegistrySnapshot {
+	struct PoolBlob {
+		std::string name;
+		std::vector<SnapshotPiece> pieces;
+	};
+
+	std::vector<unsigned char> entities;
+	std::vector<PoolBlob> pools;
+
+	// The whole snapshot as a single buffer, to write to a file
+	void write(std::vector<unsigned char>& bytes) const;
+
+	// Each pool blob is a single piece pointing into the buffer, which it
+	// keeps alive, instead of copying it
+	bool read(const std::shared_ptr<const std::vector<unsigned char>>& bytes);
+};
+
+// Snapshots of the last frames in a ring, for rollback and rewinding. Pool
+// pages that didn't change since the previous frame share its pieces, so a
+// frame only costs the entity table and the pages that were written.
+class RollbackBuffer {
+
+private:
+	std::vector<RegistrySnapshot> snapshots;
+	// Frame held by each slot, -1 when empty
+	std::vector<int> frames;
+
+	int getSlot(int frame) const;
+
+public:
+	explicit RollbackBuffer(int capacity);
+
+	int getCapacity() const;
+	bool hasFrame(int frame) const;
+
+	// Overwrites the oldest frame of the ring. When the registry can't be
+	// saved the frame is dropped, so it can't be restored
+	bool save(const class Registry& registry, int frame);
+
+	// Loads the frame and drops the frames after it, which are simulated again.
+	// Commands still pending in the registry are dropped, they belong to the
+	// frames being undone. False when the frame isn't in the ring anymore.
+	bool restore(class Registry& registry, int frame);
+
+	void clear();
+};
+
 class Registry {
 
 private:
-	int numEntities = 0;
-	std::set<Entity> entitiesToBeAdded;
-	std::set<Entity> entitiesToBeKilled;
+	// Current handle of every entity id. The slot of a dead id keeps its next
+	// generation and, in the id bits, the next free id (an implicit free list),
+	// so recycling ids needs no extra container. Ids are reused first in first
+	// out, so a stale handle only aliases a live entity once its id went around
+	// the whole list ENTITY_GENERATION_MASK times. An id whose generation would
+	// wrap is retired instead of freed, and never handed out again.
+	std::vector<uint32_t> entityHandles;
+	int nextFreeId = -1;
+	int lastFreeId = -1;
+
+	// Entities whose signature changed since the last update, new ones included
+	std::vector<Entity> entitiesToBeRefreshed;
+	std::vector<bool> entityIsQueuedForRefresh;
+	std::vector<Entity> entitiesToBeKilled;
+
+	// One command buffer per thread slot, merged in slot order by update()
+	CommandBuffer commandBuffers[MAX_THREAD_SLOTS];
 
 	std::vector<std::shared_ptr<IPool>> componentPools;
 
 	std::vector<Signature> entityComponentSignatures;
 
-	std::unordered_map<std::type_index, std::shared_ptr<System>> systems;
+	// Signature of each entity when it was last matched with the systems
+	std::vector<Signature> entitySystemSignatures;
+	std::vector<bool> entityIsInSystems;
+
+	// Indexed by SystemType id, null for the systems the registry doesn't have
+	std::vector<std::shared_ptr<System>> systems;
+
+	// Systems interested in every signature seen so far, rebuilt when the systems change
+	std::unordered_map<Signature, std::vector<System*>> systemsPerSignature;
+
+	// Tag and group names are interned to small ids, shared by every registry
+	static std::unordered_map<std::string, int> tagIds;
+	static std::unordered_map<std::string, int> groupIds;
+
+	// Tag id of each entity, -1 when untagged, and the entity holding each tag
+	std::vector<int> entityTags;
+	std::vector<Entity> entityPerTag;
 
-	std::deque<int> freeIds;
+	// Groups of each entity, stored next to its component signature
+	std::vector<GroupSignature> entityGroupSignatures;
 
-	std::unordered_map<std::string, Entity> entityPerTag;
-	std::unordered_map<int, std::string> tagPerEntity;
+	// Dense list of the entities of each group, with their index in the list
+	std::vector<std::vector<Entity>> entitiesPerGroup;
+	std::vector<std::vector<int>> entityIndexPerGroup;
 
-	std::unordered_map<std::string, std::set<Entity>> entitiesPerGroup;
-	std::unordered_map<int, std::string> groupPerEntity;
+	template <typename TComponent> Pool<TComponent>* getPool() const;
+	template <typename TComponent> void eraseComponent(Entity entity);
+	template <typename TComponent> Pool<TComponent>* assurePool();
+
+	struct OwningGroupData {
+		Signature signature;
+		std::vector<IPool*> pools;
+		int size = 0;
+	};
+
+	std::vector<std::unique_ptr<OwningGroupData>> owningGroups;
+
+	const OwningGroupData* findOrCreateOwningGroup(const Signature& signature, const std::vector<IPool*>& pools);
+	bool isInOwningGroup(const OwningGroupData& group, int entityId) const;
+	void addEntityToOwningGroups(Entity entity);
+	void removeEntityFromOwningGroup(OwningGroupData& group, int entityId);
+
+	void queueSystemsRefresh(Entity entity);
+	void refreshEntitySystems(Entity entity);
+	const std::vector<System*>& getInterestedSystems(const Signature& signature);
+
+	// Scratch space of the bulk refresh, kept between updates
+	std::vector<Entity> bulkRefreshEntities;
+	std::vector<Signature> bulkRefreshOldSignatures;
+	std::vector<Signature> bulkRefreshNewSignatures;
+	std::vector<uint8_t> bulkRefreshWasInSystems;
+	std::vector<uint8_t> bulkRefreshOldMatches;
+	std::vector<uint8_t> bulkRefreshNewMatches;
+
+	void refreshSystemsInBulk();
+
+	// Runs the chunks of View::parallelEach, optional
+	JobSystem* jobSystem = nullptr;
+
+	// Advanced by every update(), component writes and system membership
+	// changes are stamped with it
+	uint32_t currentTick = 1;
+
+	// Replaces the pools when the registry is created with ARCHETYPE_STORAGE
+	std::unique_ptr<ArchetypeStorage> archetypeStorage;
+
+	// Prefabs by name
+	std::unordered_map<std::string, std::unique_ptr<Prefab>> prefabs;
+
+	// Creates the pool of a component type from its name when a snapshot is
+	// loaded, filled in the first time a pool of the type is created
+	static std::unordered_map<std::string, IPool* (*)(Registry& registry)> snapshotPoolTypes;
+
+	// Creates an entity without logging it, queued for the systems refresh
+	Entity allocateEntity();
+
+	template <typename TComponent> static void instantiateComponent(Registry& registry, const void* value, const Entity* entities, int count);
+
+	friend class CommandBuffer;
+	friend class Prefab;
 
 public:
-	Registry() = default;
+	Registry(StorageMode storageMode = SPARSE_SET_STORAGE);
 	~Registry() = default;
 
+	StorageMode getStorageMode() const;
+
 	// in this method we actually add or remove entities.
 	// it's being executed at the end of update game loop method.
 	void update();
 
+	// Command buffer of the calling thread. Structural changes made from worker
+	// threads have to go through it.
+	CommandBuffer& getCommandBuffer();
+	static int getThreadSlot();
+
+	void setJobSystem(JobSystem* jobSystem);
+	JobSystem* getJobSystem() const;
+
+	uint32_t getCurrentTick() const;
+
 	Entity createEntity();
+	bool valid(Entity entity) const;
+
+	// Creates the prefab, or clears the one that already has this name
+	Prefab& createPrefab(const std::string& name);
+	// Null when there is no prefab with this name. The prefab lives as long as
+	// the registry, so hot code can look it up once and keep the pointer
+	const Prefab* getPrefab(const std::string& name) const;
+
+	// Creates count entities with the components and groups of the prefab,
+	// without going through addComponent for each of them. Worker threads have
+	// to use CommandBuffer::instantiate() instead.
+	std::vector<Entity> instantiate(const Prefab& prefab, int count);
+	void instantiate(const Prefab& prefab, int count, std::vector<Entity>& entities);
+
+	// Snapshots need sparse set storage. Saving fails, with an error, when
+	// the registry holds components that didn't opt in to snapshots (see
+	// SnapshotName), since loading the snapshot would lose them. Commands
+	// still in the command buffers aren't saved: save right after update()
+	// to capture everything.
+	bool saveSnapshot(RegistrySnapshot& snapshot) const;
+
+	// Replaces every entity and component, dropping the pending refreshes,
+	// kills and recorded commands, and matches the entities with the systems again
+	bool loadSnapshot(const RegistrySnapshot& snapshot);
 
 	template <typename TComponent, typename ...TArgs> void addComponent(Entity entity, TArgs&& ...args);
-	void killEntity(Entity entity);
 
+	// Killing an entity and removing a component are deferred to the next update()
+	void killEntity(Entity entity);
 	template <typename TComponent> void removeComponent(Entity entity);
 	template <typename TComponent> bool hasComponent(Entity entity) const;
+	// getComponent<T> marks the component as changed even when the caller only
+	// reads it. Only getComponent<const T> reads without stamping the tick.
 	template <typename TComponent> TComponent& getComponent(Entity entity) const;
 
+	// Calls function(Entity, const TComponent&) for the components written at
+	// or after the tick. With archetype storage the ticks are kept per chunk, so
+	// unchanged components of a changed chunk are visited too.
+	template <typename TComponent, typename TFunction> void forEachChangedSince(uint32_t tick, TFunction&& function) const;
+
+	// Tick of the last write to the entity's component, per chunk with archetype storage
+	template <typename TComponent> uint32_t getChangeTick(Entity entity) const;
+
+	// Sparse set storage only, null with archetype storage
+	template <typename TComponent> std::shared_ptr<Pool<TComponent>> getComponentPool() const;
+	template <typename ...TComponents> View<TComponents...> view();
+
+	// Creates the group the first time, sorting the pools of its components.
+	// Logs an error and returns an empty group when one of the pools is
+	// already owned by another group, or with archetype storage, where the
+	// archetypes already keep the components of an entity together.
+	template <typename ...TComponents> OwningGroup<TComponents...> owningGroup();
+
 	template <typename TSystem, typename ...TArgs> void addSystem(TArgs&& ...args);
 	template <typename TSystem> void removeSystem();
 	template <typename TSystem> bool hasSystem() const;
@@ -208,14 +1793,31 @@ public:
 	void addEntityToSystems(Entity entity);
 	void removeEntityFromSystems(Entity entity);
 
+	// Interns a tag or group name. Hot code should keep the id instead of the
+	// name, so checking a tag or a group is a single lookup or bit test.
+	static int getTagId(const std::string& tag);
+	static int getGroupId(const std::string& group);
+
+	// Id of a name interned before, -1 when it never was. The lookups taking a
+	// name use these and never intern: an unknown tag has no entity and an
+	// unknown group is empty.
+	static int findTagId(const std::string& tag);
+	static int findGroupId(const std::string& group);
+
 	void tagEntity(Entity entity, const std::string& tag);
+	void tagEntity(Entity entity, int tag);
 	bool entityHasTag(Entity entity, const std::string& tag) const;
+	bool entityHasTag(Entity entity, int tag) const;
 	Entity getEntityByTag(const std::string& tag) const;
+	Entity getEntityByTag(int tag) const;
 	void removeEntityTag(Entity entity);
 
 	void groupEntity(Entity entity, const std::string& group);
+	void groupEntity(Entity entity, int group);
 	bool entityBelongsToGroup(Entity entity, const std::string& group) const;
-	std::vector<Entity> getEntitiesByGroup(const std::string& group) const;
+	bool entityBelongsToGroup(Entity entity, int group) const;
+	const std::vector<Entity>& getEntitiesByGroup(const std::string& group) const;
+	const std::vector<Entity>& getEntitiesByGroup(int group) const;
 	void removeEntityGroup(Entity entity);
 
 };
@@ -223,40 +1825,162 @@ public:
 
 // TEMPLATES
 
+// ComponentInfo templates
+template <typename TComponent> const ComponentInfo* ComponentInfo::get() {
+	static const ComponentInfo info = {
+		sizeof(TComponent),
+		alignof(TComponent),
+		[](void* destination, void* source) {
+			new (destination) TComponent(std::move(*static_cast<TComponent*>(source)));
+		},
+		[](void* destination, const void* source, int count) {
+			std::uninitialized_fill_n(static_cast<TComponent*>(destination), count, *static_cast<const TComponent*>(source));
+		},
+		[](void* component) {
+			static_cast<TComponent*>(component)->~TComponent();
+		}
+	};
+	return &info;
+}
+
+// Archetype templates
+template <typename TComponent> TComponent* Archetype::getColumn(int chunk) const {
+	return reinterpret_cast<TComponent*>(chunks[chunk]->bytes + columnOffsets[Component<TComponent>::getId()]);
+}
+
+// ArchetypeStorage templates
+template <typename TComponent, typename ...TArgs> void ArchetypeStorage::emplace(Entity entity, TArgs&& ...args) {
+	const int componentId = Component<TComponent>::getId();
+	componentInfos[componentId] = ComponentInfo::get<TComponent>();
+
+	EntityLocation& location = getLocation(entity.getId());
+
+	if (location.archetype != -1 && archetypes[location.archetype]->signature.test(componentId)) {
+		get<TComponent>(entity.getId()) = TComponent(std::forward<TArgs>(args)...);
+		return;
+	}
+
+	int targetArchetype;
+	if (location.archetype == -1) {
+		Signature signature;
+		signature.set(componentId);
+		targetArchetype = getArchetype(signature);
+	} else {
+		Archetype& archetype = *archetypes[location.archetype];
+		if (archetype.addEdges[componentId] == -1) {
+			Signature signature = archetype.signature;
+			signature.set(componentId);
+			archetype.addEdges[componentId] = getArchetype(signature);
+		}
+		targetArchetype = archetype.addEdges[componentId];
+	}
+
+	// The arguments may refer to components of the entity, which moving it
+	// relocates, so the component is built before the move
+	TComponent component(std::forward<TArgs>(args)...);
+	const int row = moveEntity(entity, targetArchetype);
+	new (archetypes[targetArchetype]->getComponent(row, componentId)) TComponent(std::move(component));
+}
+
+template <typename TComponent> TComponent& ArchetypeStorage::get(int entityId) {
+	const int componentId = Component<TComponent>::getId();
+	const EntityLocation& location = entityLocations[entityId];
+	Archetype& archetype = *archetypes[location.archetype];
+
+	if constexpr (!std::is_const_v<TComponent>) {
+		archetype.stamp(location.row / archetype.chunkCapacity, componentId, *currentTick);
+	}
+
+	return *static_cast<TComponent*>(archetype.getComponent(location.row, componentId));
+}
+
+template <typename TComponent, typename TFunction> void ArchetypeStorage::forEachChangedSince(uint32_t tick, TFunction&& function) const {
+	const int componentId = Component<TComponent>::getId();
+
+	for (auto& archetype: archetypes) {
+		if (!archetype->signature.test(componentId)) {
+			continue;
+		}
+
+		for (int chunk = 0; chunk * archetype->chunkCapacity < archetype->size; chunk++) {
+			if (archetype->chunks[chunk]->changeTicks[componentId].load(std::memory_order_relaxed) < tick) {
+				continue;
+			}
+
+			const Entity* entities = archetype->getEntities(chunk);
+			const TComponent* components = archetype->template getColumn<const TComponent>(chunk);
+
+			for (int i = 0; i < archetype->getChunkSize(chunk); i++) {
+				function(entities[i], components[i]);
+			}
+		}
+	}
+}
+
 // Registry templates
 template <typename TComponent, typename ...TArgs> void Registry::addComponent(Entity entity, TArgs&& ...args) {
+	if (DeferredChangesScope::isActive()) {
+		getCommandBuffer().addComponent<TComponent>(entity, std::forward<TArgs>(args)...);
+		return;
+	}
+
 	const auto componentId = Component<TComponent>::getId();
 	const auto entityId = entity.getId();
 
-	if (componentId >= componentPools.size()) {
-		componentPools.resize(componentId + 1, nullptr);
-	}
+	entity.registry = this;
 
-	if (!componentPools[componentId]) {
-		std::shared_ptr<Pool<TComponent>> newComponentPool = std::make_shared<Pool<TComponent>>();
-		componentPools[componentId] = newComponentPool;
-	}
-
-	std::shared_ptr<Pool<TComponent>> componentPool = std::static_pointer_cast<Pool<TComponent>>(componentPools[componentId]);
+	if (archetypeStorage) {
+		archetypeStorage->emplace<TComponent>(entity, std::forward<TArgs>(args)...);
 
-	if (entityId >= componentPool->getSize()) {
-		componentPool->resize(numEntities);
+		if (!entityComponentSignatures[entityId].test(componentId)) {
+			entityComponentSignatures[entityId].set(componentId);
+			queueSystemsRefresh(entity);
+		}
+		return;
 	}
 
-	TComponent newComponent(std::forward<TArgs>(args)...);
+	auto componentPool = assurePool<TComponent>();
+	componentPool->emplace(entity, std::forward<TArgs>(args)...);
 
-	componentPool->set(entityId, newComponent);
+	if (!entityComponentSignatures[entityId].test(componentId)) {
+		entityComponentSignatures[entityId].set(componentId);
+		queueSystemsRefresh(entity);
 
-	entityComponentSignatures[entityId].set(componentId);
+		if (componentPool->owningGroup != -1) {
+			addEntityToOwningGroups(entity);
+		}
+	}
 
 	//Logger::info("Component id " + std::to_string(componentId) + " added to the entity id = " + std::to_string(entityId));
 }
 
 template <typename TComponent> void Registry::removeComponent(Entity entity) {
+	getCommandBuffer().removeComponent<TComponent>(entity);
+}
+
+template <typename TComponent> void Registry::eraseComponent(Entity entity) {
 	const auto componentId = Component<TComponent>::getId();
 	const auto entityId = entity.getId();
 
-	entityComponentSignatures[entityId].set(componentId, false);
+	if (archetypeStorage) {
+		archetypeStorage->remove(entity, componentId);
+	}
+
+	if (componentId < static_cast<int>(componentPools.size()) && componentPools[componentId]) {
+		IPool& pool = *componentPools[componentId];
+
+		// Leave the group first so the removal doesn't break its packing
+		if (pool.owningGroup != -1 && isInOwningGroup(*owningGroups[pool.owningGroup], entityId)) {
+			removeEntityFromOwningGroup(*owningGroups[pool.owningGroup], entityId);
+		}
+
+		pool.removeEntityFromPool(entityId);
+	}
+
+	if (entityComponentSignatures[entityId].test(componentId)) {
+		entityComponentSignatures[entityId].set(componentId, false);
+		queueSystemsRefresh(entity);
+	}
 }
 
 
@@ -268,30 +1992,211 @@ template <typename TComponent> bool Registry::hasComponent(Entity entity) const
 }
 
 template <typename TComponent> TComponent& Registry::getComponent(Entity entity) const {
+	typedef std::remove_const_t<TComponent> TMutableComponent;
+
 	const auto componentId = Component<TComponent>::getId();
 	const auto entityId = entity.getId();
-	auto componentPool = std::static_pointer_cast<Pool<TComponent>>(componentPools[componentId]);
-	return componentPool->get(entityId);
+
+	if (archetypeStorage) {
+		return archetypeStorage->get<TComponent>(entityId);
+	}
+
+	auto componentPool = static_cast<Pool<TMutableComponent>*>(componentPools[componentId].get());
+
+	if constexpr (std::is_const_v<TComponent>) {
+		return static_cast<const Pool<TMutableComponent>*>(componentPool)->get(entityId);
+	} else {
+		return componentPool->get(entityId);
+	}
+}
+
+template <typename TComponent> uint32_t Registry::getChangeTick(Entity entity) const {
+	if (archetypeStorage) {
+		return archetypeStorage->getChangeTick(entity.getId(), Component<TComponent>::getId());
+	}
+
+	return getPool<std::remove_const_t<TComponent>>()->getChangeTick(entity.getId());
+}
+
+template <typename TComponent, typename TFunction> void Registry::forEachChangedSince(uint32_t tick, TFunction&& function) const {
+	if (archetypeStorage) {
+		archetypeStorage->forEachChangedSince<TComponent>(tick, function);
+		return;
+	}
+
+	const Pool<TComponent>* componentPool = getPool<TComponent>();
+	if (!componentPool) {
+		return;
+	}
+
+	componentPool->forEachChangedSince(tick, [&](int index) {
+		function(componentPool->getEntity(index), (*componentPool)[index]);
+	});
+}
+
+template <typename TComponent> std::shared_ptr<Pool<TComponent>> Registry::getComponentPool() const {
+	const auto componentId = Component<TComponent>::getId();
+
+	if (componentId >= static_cast<int>(componentPools.size())) {
+		return nullptr;
+	}
+
+	return std::static_pointer_cast<Pool<TComponent>>(componentPools[componentId]);
+}
+
+template <typename TComponent> Pool<TComponent>* Registry::getPool() const {
+	const auto componentId = Component<TComponent>::getId();
+
+	if (componentId >= static_cast<int>(componentPools.size())) {
+		return nullptr;
+	}
+
+	return static_cast<Pool<TComponent>*>(componentPools[componentId].get());
+}
+
+template <typename TComponent> Pool<TComponent>* Registry::assurePool() {
+	const auto componentId = Component<TComponent>::getId();
+
+	if (componentId >= static_cast<int>(componentPools.size())) {
+		componentPools.resize(componentId + 1, nullptr);
+	}
+
+	if (!componentPools[componentId]) {
+		std::shared_ptr<Pool<TComponent>> newComponentPool = std::make_shared<Pool<TComponent>>();
+		newComponentPool->setTickSource(&currentTick);
+		componentPools[componentId] = newComponentPool;
+
+		if constexpr (SnapshotName<TComponent>::value != nullptr) {
+			snapshotPoolTypes.emplace(SnapshotName<TComponent>::value, [](Registry& registry) -> IPool* {
+				return registry.assurePool<TComponent>();
+			});
+		}
+	}
+
+	return static_cast<Pool<TComponent>*>(componentPools[componentId].get());
+}
+
+template <typename ...TComponents> OwningGroup<TComponents...> Registry::owningGroup() {
+	static const int emptySize = 0;
+
+	Signature signature;
+	(signature.set(Component<std::remove_const_t<TComponents>>::getId()), ...);
+
+	if (archetypeStorage) {
+		Logger::error("Owning groups need sparse set storage");
+		return OwningGroup<TComponents...>(jobSystem, &emptySize, static_cast<Pool<std::remove_const_t<TComponents>>*>(nullptr)...);
+	}
+
+	const OwningGroupData* group = findOrCreateOwningGroup(signature, {assurePool<std::remove_const_t<TComponents>>()...});
+	return OwningGroup<TComponents...>(jobSystem, group ? &group->size : &emptySize, assurePool<std::remove_const_t<TComponents>>()...);
+}
+
+template <typename ...TComponents> View<TComponents...> Registry::view() {
+	return View<TComponents...>(jobSystem, archetypeStorage.get(), getPool<std::remove_const_t<TComponents>>()...);
 }
 
 template <typename TSystem, typename ...TArgs> void Registry::addSystem(TArgs&& ...args) {
+	const int systemId = SystemType<TSystem>::getId();
+
+	if (systemId >= static_cast<int>(systems.size())) {
+		systems.resize(systemId + 1);
+	}
+
 	const std::shared_ptr<TSystem> newSystem = std::make_shared<TSystem>(std::forward<TArgs>(args)...);
-	systems.insert(std::make_pair(std::type_index(typeid(TSystem)),newSystem));
+	newSystem->registry = this;
+	systems[systemId] = newSystem;
+	systemsPerSignature.clear();
 }
 
 template <typename TSystem> void Registry::removeSystem() {
-	const auto index = systems.find(std::type_index(typeid(TSystem)));
-	systems.erase(index);
+	const int systemId = SystemType<TSystem>::getId();
+
+	if (systemId < static_cast<int>(systems.size())) {
+		systems[systemId].reset();
+	}
+
+	systemsPerSignature.clear();
 }
 
 template <typename TSystem> bool Registry::hasSystem() const {
-	const auto index = std::type_index(typeid(TSystem));
-	return systems.find(index) != systems.end();
+	const int systemId = SystemType<TSystem>::getId();
+	return systemId < static_cast<int>(systems.size()) && systems[systemId];
 }
 
 template <typename TSystem> TSystem& Registry::getSystem() const {
-	const auto system = systems.find(std::type_index(typeid(TSystem)));
-	return *(std::static_pointer_cast<TSystem>(system->second));
+	return static_cast<TSystem&>(*systems[SystemType<TSystem>::getId()]);
+}
+
+// SystemPipeline templates
+template <typename ...TSystems> SystemPipeline<TSystems...>::SystemPipeline(Registry& registry):
+	systems(&registry.getSystem<TSystems>()...) {}
+
+template <typename TComponent> void Registry::instantiateComponent(Registry& registry, const void* value, const Entity* entities, int count) {
+	registry.assurePool<TComponent>()->emplaceCopies(entities, count, *static_cast<const TComponent*>(value));
+}
+
+// Prefab templates
+template <typename TComponent, typename ...TArgs> Prefab& Prefab::addComponent(TArgs&& ...args) {
+	const int componentId = Component<TComponent>::getId();
+	const PrefabComponent component = {
+		componentId,
+		std::make_shared<TComponent>(std::forward<TArgs>(args)...),
+		ComponentInfo::get<TComponent>(),
+		&Registry::instantiateComponent<TComponent>
+	};
+
+	if (signature.test(componentId)) {
+		for (auto& existing: components) {
+			if (existing.componentId == componentId) {
+				existing = component;
+			}
+		}
+	} else {
+		components.push_back(component);
+		signature.set(componentId);
+	}
+
+	return *this;
+}
+
+// CommandBuffer templates
+template <typename TPayload, typename ...TArgs> void* CommandBuffer::createPayload(TArgs&& ...args) {
+	void* payload = allocate(sizeof(TPayload), alignof(TPayload));
+	return new (payload) TPayload(std::forward<TArgs>(args)...);
+}
+
+template <typename TComponent> void CommandBuffer::applyAddComponent(Registry& registry, Entity entity, void* payload) {
+	if (!registry.valid(entity)) {
+		return;
+	}
+
+	registry.addComponent<TComponent>(entity, std::move(*static_cast<TComponent*>(payload)));
+}
+
+template <typename TComponent> void CommandBuffer::applyRemoveComponent(Registry& registry, Entity entity, void* payload) {
+	if (!registry.valid(entity)) {
+		return;
+	}
+
+	registry.eraseComponent<TComponent>(entity);
+}
+
+template <typename TPayload> void CommandBuffer::destroyPayload(void* payload) {
+	static_cast<TPayload*>(payload)->~TPayload();
+}
+
+template <typename TComponent, typename ...TArgs> void CommandBuffer::addComponent(Entity entity, TArgs&& ...args) {
+	void* payload = createPayload<TComponent>(std::forward<TArgs>(args)...);
+	record(&CommandBuffer::applyAddComponent<TComponent>, &CommandBuffer::destroyPayload<TComponent>, entity, -1, payload);
+}
+
+template <typename TComponent, typename ...TArgs> void CommandBuffer::addComponent(PendingEntity entity, TArgs&& ...args) {
+	void* payload = createPayload<TComponent>(std::forward<TArgs>(args)...);
+	record(&CommandBuffer::applyAddComponent<TComponent>, &CommandBuffer::destroyPayload<TComponent>, Entity(0), entity.index, payload);
+}
+
+template <typename TComponent> void CommandBuffer::removeComponent(Entity entity) {
+	record(&CommandBuffer::applyRemoveComponent<TComponent>, nullptr, entity, -1, nullptr);
 }
 
 // Entity templates
@@ -317,5 +2222,15 @@ template <typename TComponent> void System::requireComponent() {
 	componentSignature.set(componentId);
 }
 
+template <typename TComponent> void System::readsComponent() {
+	const auto componentId = Component<TComponent>::getId();
+	readSignature.set(componentId);
+}
+
+template <typename TComponent> void System::writesComponent() {
+	const auto componentId = Component<TComponent>::getId();
+	writeSignature.set(componentId);
+}
+
 
 #endif
\ No newline at end of file
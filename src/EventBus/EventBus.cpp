@@ -0,0 +1,7 @@
+#include "EventBus.h"
+
+std::atomic<int> IEventType::nextId(0);
+
+int EventBus::getThreadSlot() {
+	return ThreadSlots::get();
+}
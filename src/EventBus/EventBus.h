@@ -1,55 +1,340 @@
 #ifndef EVENTBUS_H
 #define EVENTBUS_H
 
-#include <map>
-#include <typeindex>
-#include <list>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include <functional>
+#include <algorithm>
 
 #include "../Logger/Logger.h"
+#include "../JobSystem/JobSystem.h"
 #include "Event.h"
 
-class IEventCallback {
+// Constants
+const unsigned int MAX_EVENT_TYPES = 256;
+
+// Dense id per event type, used to index the handler lists of the bus. Worker
+// threads may be the first to use an event type.
+struct IEventType {
+
+protected:
+	static std::atomic<int> nextId;
+
+};
+
+template <typename T> class EventType : public IEventType {
+
+public:
+	static int getId() {
+		static auto id = nextId++;
+		return id;
+	}
+
+};
+
+// Contiguous run of queued events, handed to batch subscribers
+template <typename TEvent> class EventSpan {
+
+private:
+	const TEvent* first;
+	size_t count;
+
+public:
+	EventSpan(const TEvent* first, size_t count): first(first), count(count) {}
+
+	const TEvent* begin() const {
+		return first;
+	}
+
+	const TEvent* end() const {
+		return first + count;
+	}
+
+	size_t size() const {
+		return count;
+	}
+
+	bool empty() const {
+		return count == 0;
+	}
+
+	const TEvent& operator [](size_t index) const {
+		return first[index];
+	}
+
+};
+
+// Handler of an event or of a batch of events: the subscriber, its member
+// function and a trampoline that knows both types, stored inline so calling it
+// needs neither a heap object nor a virtual call
+class EventDelegate {
+
+private:
+	typedef void (EventDelegate::*AnyMemberFunction)();
+
+	void* ownerInstance;
+	void (*trampoline)(const EventDelegate& delegate, void* event);
+	unsigned char callbackFunction[sizeof(AnyMemberFunction)];
+
+	template <typename TOwner, typename TArgument> static void call(const EventDelegate& delegate, void* argument) {
+		void (TOwner::*callbackFunction)(TArgument);
+		std::memcpy(&callbackFunction, delegate.callbackFunction, sizeof(callbackFunction));
+		std::invoke(callbackFunction, static_cast<TOwner*>(delegate.ownerInstance), *static_cast<std::remove_reference_t<TArgument>*>(argument));
+	}
+
+	static void ignore(const EventDelegate&, void*) {}
+
+public:
+	int id;
+
+	// The argument is the event, or the EventSpan of a batch
+	template <typename TOwner, typename TArgument> static EventDelegate create(int id, TOwner* ownerInstance, void (TOwner::*callbackFunction)(TArgument)) {
+		static_assert(sizeof(callbackFunction) <= sizeof(AnyMemberFunction), "Member function pointer doesn't fit in the delegate");
+
+		EventDelegate delegate;
+		delegate.ownerInstance = ownerInstance;
+		delegate.trampoline = &call<TOwner, TArgument>;
+		std::memcpy(delegate.callbackFunction, &callbackFunction, sizeof(callbackFunction));
+		delegate.id = id;
+		return delegate;
+	}
+
+	// The trampoline reads everything it needs before the call, so the handler
+	// may add delegates and move this one
+	void execute(void* event) const {
+		trampoline(*this, event);
+	}
+
+	// Removed delegates call nothing until they're erased
+	void remove() {
+		trampoline = &ignore;
+	}
+
+	bool isRemoved() const {
+		return trampoline == &ignore;
+	}
+
+};
+
+// Subscribers of one event type, in subscription order. Handlers removed while
+// the event is being emitted are only disabled and get erased once the emit is
+// over, so the emit never skips or revisits a handler.
+class HandlerList {
+
 private:
-	virtual void call(Event& event) = 0;
+	std::vector<EventDelegate> handlers;
+	int nextId = 0;
+	int emitDepth = 0;
+	bool hasRemovedHandlers = false;
 
+	void eraseRemovedHandlers() {
+		handlers.erase(std::remove_if(handlers.begin(), handlers.end(), [](const EventDelegate& handler) { return handler.isRemoved(); }), handlers.end());
+		hasRemovedHandlers = false;
+	}
 
 public:
-	virtual ~IEventCallback() = default;
+	template <typename TOwner, typename TArgument> int add(TOwner* ownerInstance, void (TOwner::*callbackFunction)(TArgument)) {
+		handlers.push_back(EventDelegate::create(nextId, ownerInstance, callbackFunction));
+		return nextId++;
+	}
+
+	void remove(int id) {
+		for (auto& handler: handlers) {
+			if (handler.id == id && !handler.isRemoved()) {
+				handler.remove();
+				hasRemovedHandlers = true;
+			}
+		}
+
+		if (emitDepth == 0 && hasRemovedHandlers) {
+			eraseRemovedHandlers();
+		}
+	}
+
+	void removeAll() {
+		for (auto& handler: handlers) {
+			handler.remove();
+		}
+
+		hasRemovedHandlers = !handlers.empty();
+		if (emitDepth == 0) {
+			eraseRemovedHandlers();
+		}
+	}
+
+	// Every handler gets the same event or batch. Handlers added by a handler
+	// during the emit wait for the next one.
+	void emit(void* event) {
+		emitDepth++;
+
+		const size_t numHandlers = handlers.size();
+		for (size_t i = 0; i < numHandlers; i++) {
+			handlers[i].execute(event);
+		}
+
+		if (--emitDepth == 0 && hasRemovedHandlers) {
+			eraseRemovedHandlers();
+		}
+	}
 
-	void execute(Event& event) {
-		call(event);
+	bool isEmpty() const {
+		return handlers.empty();
 	}
 
 };
 
-template <typename TOwner, typename TEvent> class EventCallback : public IEventCallback {
-	// Callback function pointer that needs to be invoked
-	private:
-		typedef void (TOwner::*CallbackFunction)(TEvent&);
+// Unsubscribes when destroyed, so the owner of the callback keeps it as a
+// member. Outliving the event bus is fine, it does nothing then.
+class EventSubscription {
 
-		TOwner* ownerInstance;
-		CallbackFunction callbackFunction;
+private:
+	std::weak_ptr<HandlerList> handlers;
+	int id = -1;
+
+public:
+	EventSubscription() = default;
+	EventSubscription(std::weak_ptr<HandlerList> handlers, int id): handlers(std::move(handlers)), id(id) {}
 
-		virtual void call(Event& event) override {
-			std::invoke(callbackFunction, ownerInstance, static_cast<TEvent&>(event));
+	EventSubscription(const EventSubscription&) = delete;
+	EventSubscription& operator = (const EventSubscription&) = delete;
+
+	EventSubscription(EventSubscription&& other) noexcept: handlers(std::move(other.handlers)), id(other.id) {
+		other.handlers.reset();
+	}
+
+	EventSubscription& operator = (EventSubscription&& other) noexcept {
+		if (this != &other) {
+			unsubscribe();
+			handlers = std::move(other.handlers);
+			id = other.id;
+			other.handlers.reset();
 		}
+		return *this;
+	}
+
+	~EventSubscription() {
+		unsubscribe();
+	}
 
-	public:
-		EventCallback(TOwner* ownerInstance, CallbackFunction callbackFunction) {
-			this->ownerInstance = ownerInstance;
-			this->callbackFunction = callbackFunction;
+	void unsubscribe() {
+		if (auto list = handlers.lock()) {
+			list->remove(id);
 		}
+		handlers.reset();
+	}
+
+};
+
+// Queued events with an orderKey() member are dispatched sorted by it, so
+// their order doesn't depend on which thread raised them or on how the jobs
+// were split, as long as events from different threads don't share a key.
+// Events without one are dispatched in the order of the thread slots: the
+// order of the systems when the Scheduler runs them, but not fixed for events
+// raised from the chunks of a parallelEach.
+template <typename TEvent, typename = void> struct HasEventOrderKey : std::false_type {};
 
-		virtual ~EventCallback() override = default;
+template <typename TEvent> struct HasEventOrderKey<TEvent, std::void_t<
+	decltype(std::declval<const TEvent&>().orderKey() < std::declval<const TEvent&>().orderKey())>> : std::true_type {};
 
+class IEventQueue {
+public:
+	virtual ~IEventQueue() = default;
+
+	// Batch subscribers of the queue
+	std::shared_ptr<HandlerList> handlers = std::make_shared<HandlerList>();
 };
 
-typedef std::list<std::unique_ptr<IEventCallback>> HandlerList;
+// Events of one type waiting for their dispatch, in a buffer per thread slot.
+// Every thread only appends to its own buffer, so enqueueing needs no locks.
+// The dispatch moves them all to a single batch, and events enqueued while the
+// batch is being dispatched wait for the next dispatch. The buffers keep
+// their capacity from frame to frame.
+template <typename TEvent> class EventQueue : public IEventQueue {
+public:
+	struct alignas(64) ThreadBuffer {
+		std::vector<TEvent> events;
+	};
+
+	ThreadBuffer threadBuffers[MAX_THREAD_SLOTS];
+	std::vector<TEvent> dispatchedEvents;
+	bool isDispatching = false;
+
+	// Scratch space of the sort by order key
+	std::vector<uint32_t> sortedIndices;
+	std::vector<TEvent> sortedEvents;
+
+	void mergeThreadBuffers() {
+		for (auto& threadBuffer: threadBuffers) {
+			if (!threadBuffer.events.empty()) {
+				dispatchedEvents.insert(dispatchedEvents.end(), std::make_move_iterator(threadBuffer.events.begin()), std::make_move_iterator(threadBuffer.events.end()));
+				threadBuffer.events.clear();
+			}
+		}
+
+		if constexpr (HasEventOrderKey<TEvent>::value) {
+			auto compare = [](const TEvent& a, const TEvent& b) { return a.orderKey() < b.orderKey(); };
+			if (std::is_sorted(dispatchedEvents.begin(), dispatchedEvents.end(), compare)) {
+				return;
+			}
+
+			// Ties are broken by position, so events a thread raised with the same
+			// key keep their order. The scratch vectors keep their capacity.
+			sortedIndices.resize(dispatchedEvents.size());
+			for (uint32_t i = 0; i < sortedIndices.size(); i++) {
+				sortedIndices[i] = i;
+			}
+
+			std::sort(sortedIndices.begin(), sortedIndices.end(), [this](uint32_t a, uint32_t b) {
+				const auto keyA = dispatchedEvents[a].orderKey();
+				const auto keyB = dispatchedEvents[b].orderKey();
+				return keyA < keyB || (!(keyB < keyA) && a < b);
+			});
+
+			sortedEvents.clear();
+			for (auto index: sortedIndices) {
+				sortedEvents.push_back(std::move(dispatchedEvents[index]));
+			}
+			dispatchedEvents.swap(sortedEvents);
+		}
+	}
+};
 
 class EventBus {
 
 private:
-	std::map<std::type_index, std::unique_ptr<HandlerList>> subscribers;
+	// Handler lists by event type id. They're never destroyed before the bus,
+	// so an emit can't lose its list while a handler runs.
+	std::vector<std::shared_ptr<HandlerList>> subscribers;
+
+	// Queued events and their batch subscribers by event type id. Fixed so
+	// worker threads can look them up while another one is created.
+	std::atomic<IEventQueue*> queues[MAX_EVENT_TYPES] = {};
+
+	// Null when there are more event types than queues
+	template <typename TEvent> EventQueue<TEvent>* assureQueue() {
+		const int eventId = EventType<TEvent>::getId();
+		if (eventId >= static_cast<int>(MAX_EVENT_TYPES)) {
+			Logger::error("More event types than event queues");
+			return nullptr;
+		}
+
+		IEventQueue* queue = queues[eventId].load(std::memory_order_acquire);
+		if (!queue) {
+			// Threads racing to create the queue keep the first one
+			IEventQueue* newQueue = new EventQueue<TEvent>();
+			if (queues[eventId].compare_exchange_strong(queue, newQueue, std::memory_order_acq_rel)) {
+				queue = newQueue;
+			} else {
+				delete newQueue;
+			}
+		}
+
+		return static_cast<EventQueue<TEvent>*>(queue);
+	}
 
 public:
 	EventBus() {
@@ -57,35 +342,110 @@ public:
 	}
 
 	~EventBus() {
+		for (auto& queue: queues) {
+			delete queue.load();
+		}
+
 		Logger::info("EventBus destructor called!");
 	}
 
+	EventBus(const EventBus&) = delete;
+	EventBus& operator = (const EventBus&) = delete;
+
+	// Buffer of the calling thread in the event queues, the same slot as its
+	// command buffer in the registry
+	static int getThreadSlot();
+
+	// Subscriptions last until the returned handle is destroyed, they don't
+	// have to be renewed every frame
 	template<typename TEvent, typename TOwner>
-	void subscribeToEvent(TOwner* ownerInstance, void (TOwner::*callbackFunction)(TEvent&)) {
-		if (!subscribers[typeid(TEvent)].get()) {
-			subscribers[typeid(TEvent)] = std::make_unique<HandlerList>();
+	[[nodiscard]] EventSubscription subscribeToEvent(TOwner* ownerInstance, void (TOwner::*callbackFunction)(TEvent&)) {
+		const int eventId = EventType<TEvent>::getId();
+		if (eventId >= static_cast<int>(subscribers.size())) {
+			subscribers.resize(eventId + 1);
 		}
 
-		auto subscriber = std::make_unique<EventCallback<TOwner, TEvent>>(ownerInstance, callbackFunction);
-		subscribers[typeid(TEvent)]->push_back(std::move(subscriber));
+		auto& handlers = subscribers[eventId];
+		if (!handlers) {
+			handlers = std::make_shared<HandlerList>();
+		}
+
+		const int id = handlers->add(ownerInstance, callbackFunction);
+		return EventSubscription(handlers, id);
 	}
 
+	// The event is only constructed when it has subscribers, once for all of them
 	template <typename TEvent, typename ...TArgs>
 	void emit(TArgs&& ...args) {
-		auto handlers = subscribers[typeid(TEvent)].get();
-		if (handlers) {
-			for (auto it = handlers->begin(); it != handlers->end(); it++) {
-				auto handler = it->get();
-				TEvent event(std::forward<TArgs>(args)...);
-				handler->execute(event);
-			}
+		const int eventId = EventType<TEvent>::getId();
+		if (eventId >= static_cast<int>(subscribers.size()) || !subscribers[eventId] || subscribers[eventId]->isEmpty()) {
+			return;
+		}
+
+		TEvent event(std::forward<TArgs>(args)...);
+		subscribers[eventId]->emit(&event);
+	}
+
+	// Batch subscribers get the events queued with enqueue<TEvent>() all at
+	// once, in the order they were queued, when dispatch<TEvent>() is called.
+	// Emitted events don't reach them, nor queued events the other subscribers.
+	template<typename TEvent, typename TOwner>
+	[[nodiscard]] EventSubscription subscribeToBatch(TOwner* ownerInstance, void (TOwner::*callbackFunction)(EventSpan<TEvent>)) {
+		auto queue = assureQueue<TEvent>();
+		if (!queue) {
+			return EventSubscription();
+		}
+
+		const int id = queue->handlers->add(ownerInstance, callbackFunction);
+		return EventSubscription(queue->handlers, id);
+	}
+
+	// Safe to call from any thread, including job system workers
+	template <typename TEvent, typename ...TArgs>
+	void enqueue(TArgs&& ...args) {
+		if (auto queue = assureQueue<TEvent>()) {
+			queue->threadBuffers[getThreadSlot()].events.emplace_back(std::forward<TArgs>(args)...);
 		}
 	}
 
+	// Hands the events queued by every thread to the batch subscribers and
+	// empties the queue. This is the sync point of the queue: no other thread
+	// may enqueue events of the type meanwhile. A dispatch of the same type
+	// from one of the subscribers does nothing.
+	template <typename TEvent>
+	void dispatch() {
+		auto queue = assureQueue<TEvent>();
+		if (!queue || queue->isDispatching) {
+			return;
+		}
+
+		queue->isDispatching = true;
+		queue->mergeThreadBuffers();
+
+		if (!queue->dispatchedEvents.empty()) {
+			EventSpan<TEvent> batch(queue->dispatchedEvents.data(), queue->dispatchedEvents.size());
+			queue->handlers->emit(&batch);
+		}
+
+		queue->dispatchedEvents.clear();
+		queue->isDispatching = false;
+	}
+
+	// Drops every subscription, their handles do nothing afterwards
 	void reset() {
-		subscribers.clear();
+		for (auto& handlers: subscribers) {
+			if (handlers) {
+				handlers->removeAll();
+			}
+		}
+
+		for (auto& queue: queues) {
+			if (auto eventQueue = queue.load()) {
+				eventQueue->handlers->removeAll();
+			}
+		}
 	}
 
 };
 
-#endif
\ No newline at end of file
+#endif
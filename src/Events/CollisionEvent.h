@@ -11,6 +11,11 @@ public:
     Entity b;
     CollisionEvent(Entity a, Entity b): a(a), b(b) {}
 
+	// Queued collisions are dispatched sorted by their pair of entities
+	uint64_t orderKey() const {
+		return (static_cast<uint64_t>(a.getHandle()) << 32) | b.getHandle();
+	}
+
 };
 
 #endif
\ No newline at end of file
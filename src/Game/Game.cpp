@@ -3,6 +3,8 @@
 #include <iostream>
 #include <memory>
 #include <fstream>
+#include <cmath>
+#include <algorithm>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
@@ -15,6 +17,7 @@
 #include "../Logger/Logger.h"
 #include "../ECS/ECS.h"
 #include "../EventBus/EventBus.h"
+#include "../Clock/Clock.h"
 #include "../Events/KeyPressedEvent.h"
 #include "../Components/TransformComponent.h"
 #include "../Components/RigidBodyComponent.h"
@@ -26,7 +29,10 @@
 #include "../Components/ProjectileEmitterComponent.h"
 #include "../Components/HealthComponent.h"
 #include "../Components/TextLabelComponent.h"
+#include "../Components/ProjectileComponent.h"
+#include "../Components/HierarchyComponent.h"
 #include "../Systems/MovementSystem.h"
+#include "../Systems/HierarchySystem.h"
 #include "../Systems/RenderSystem.h"
 #include "../Systems/AnimationSystem.h"
 #include "../Systems/CollisionSystem.h"
@@ -40,26 +46,67 @@
 #include "../Systems/RenderHealthBarSystem.h"
 #include "../Systems/RenderGUISystem.h"
 
+// Systems the game calls directly every frame, resolved once when the level loads
+struct GameSystems {
+	SystemPipeline<MovementSystem, DamageSystem, KeyboardControlSystem, ProjectileEmitSystem> eventSubscribers;
+	SystemPipeline<RenderSystem, RenderTextSystem, RenderHealthBarSystem> render;
+	SystemPipeline<RenderColliderSystem, RenderGUISystem> debugRender;
+
+	explicit GameSystems(Registry& registry): eventSubscribers(registry), render(registry), debugRender(registry) {}
+};
+
 int Game::windowWidth;
 int Game::windowHeight;
 int Game::mapWidth;
 int Game::mapHeight;
 
-Game::Game() {
+Game::Game(StorageMode storageMode): rollbackBuffer(ROLLBACK_FRAMES), frameDeltaTimes(ROLLBACK_FRAMES), frameTicks(ROLLBACK_FRAMES) {
 	Logger::info("Creating a Game instance");
 	isRunning = false;
 	isDebug = false;
-	registry = std::make_unique<Registry>();
-	assetStore = std::make_unique<AssetStore>();
+	millisecsPreviousFrame = 0;
+	deltaTime = 0;
+	window = nullptr;
+	renderer = nullptr;
+	jobSystem = std::make_unique<JobSystem>();
+	registry = std::make_unique<Registry>(storageMode);
+	registry->setJobSystem(jobSystem.get());
+	hasSnapshots = storageMode == SPARSE_SET_STORAGE;
+	if (!hasSnapshots) {
+		Logger::info("Quick saves, restarts, rewinds and rollbacks are disabled with archetype storage");
+	}
+	assetStore = std::make_unique<AssetStore>(jobSystem.get());
 	eventBus = std::make_unique<EventBus>();
+	scheduler = std::make_unique<Scheduler>(*jobSystem);
 }
 
 Game::~Game() {
 	Logger::info("Destroying a Game instance");
 }
 
+bool Game::recordInput(const std::string& filePath) {
+	inputRecorder = std::make_unique<InputRecorder>();
+	if (!inputRecorder->open(filePath)) {
+		inputRecorder.reset();
+		return false;
+	}
+	return true;
+}
+
+bool Game::replayInput(const std::string& filePath) {
+	inputReplay = std::make_unique<InputReplay>();
+	if (!inputReplay->open(filePath)) {
+		inputReplay.reset();
+		return false;
+	}
+
+	isHeadless = true;
+	return true;
+}
+
 void Game::initialize() {
-	if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
+	// Headless games have no window, renderer nor GUI
+	if (SDL_Init(isHeadless ? SDL_INIT_TIMER : SDL_INIT_EVERYTHING) != 0) {
         Logger::error("Error initializing SDL.");
         return;
     }
@@ -69,10 +116,22 @@ void Game::initialize() {
         return;
     }
 
-    SDL_DisplayMode displayMode;
-    SDL_GetCurrentDisplayMode(0, &displayMode);
     windowWidth = 800;
     windowHeight = 600;
+
+    // Initialize the camera view with the entire screen area
+    camera.x = 0;
+    camera.y = 0;
+    camera.w = windowWidth;
+    camera.h = windowHeight;
+
+    if (isHeadless) {
+        isRunning = true;
+        return;
+    }
+
+    SDL_DisplayMode displayMode;
+    SDL_GetCurrentDisplayMode(0, &displayMode);
     window = SDL_CreateWindow(
         "2D Game Engine",
         SDL_WINDOWPOS_CENTERED,
@@ -95,18 +154,13 @@ void Game::initialize() {
     ImGui::CreateContext();
     ImGuiSDL::Initialize(renderer, windowWidth, windowHeight);
 
-    // Initialize the camera view with the entire screen area
-    camera.x = 0;
-    camera.y = 0;
-    camera.w = windowWidth;
-    camera.h = windowHeight;
-
     isRunning = true;
 }
 
 void Game::loadLevel(int level) {
 	// Add the systems that need to be processed in our game
 	registry->addSystem<MovementSystem>();
+	registry->addSystem<HierarchySystem>();
 	registry->addSystem<RenderSystem>();
 	registry->addSystem<AnimationSystem>();
 	registry->addSystem<CollisionSystem>();
@@ -120,17 +174,59 @@ void Game::loadLevel(int level) {
 	registry->addSystem<RenderHealthBarSystem>();
 	registry->addSystem<RenderGUISystem>();
 
-	// Adding assets
-	assetStore->addTexture(renderer, "tank-image", "./assets/images/tank-panther-right.png");
-	assetStore->addTexture(renderer, "truck-image", "./assets/images/truck-ford-right.png");
-	assetStore->addTexture(renderer, "chopper-image", "./assets/images/chopper-spritesheet.png");
-	assetStore->addTexture(renderer, "radar-image", "./assets/images/radar.png");
-	assetStore->addTexture(renderer, "tilemap-image", "./assets/tilemaps/jungle.png");
-	assetStore->addTexture(renderer, "bullet-image", "./assets/images/bullet.png");
-	assetStore->addTexture(renderer, "tree-image", "./assets/images/tree.png");
-	assetStore->addFont("charriot-font-20", "./assets/fonts/charriot.ttf", 20);
-	assetStore->addFont("pico8-font-5", "./assets/fonts/pico8.ttf", 5);
-	assetStore->addFont("pico8-font-10", "./assets/fonts/pico8.ttf", 10);
+	systems = std::make_unique<GameSystems>(*registry);
+
+	// The systems stay subscribed until they're destroyed
+	systems->eventSubscribers.forEach([this](auto& system) { system.subscribeToEvents(eventBus); });
+
+	// Projectiles only differ by position, velocity and damage, the emitters set those
+	registry->createPrefab("bullet")
+		.group(Registry::getGroupId("projectiles"))
+		.addComponent<TransformComponent>(glm::vec2(0, 0), glm::vec2(1.0, 1.0), 0)
+		.addComponent<RigidBodyComponent>()
+		.addComponent<SpriteComponent>("bullet-image", 4, 4, 4)
+		.addComponent<BoxColliderComponent>(4, 4)
+		.addComponent<ProjectileComponent>();
+
+	// Schedule the simulation systems in their serial order, the scheduler runs
+	// the ones with no conflicting component access in parallel. Rendering stays
+	// on the main thread
+	auto& movementSystem = registry->getSystem<MovementSystem>();
+	auto& hierarchySystem = registry->getSystem<HierarchySystem>();
+	auto& animationSystem = registry->getSystem<AnimationSystem>();
+	auto& collisionSystem = registry->getSystem<CollisionSystem>();
+	auto& projectileEmitSystem = registry->getSystem<ProjectileEmitSystem>();
+	auto& projectileLifecycleSystem = registry->getSystem<ProjectileLifecycleSystem>();
+	auto& cameraMovementSystem = registry->getSystem<CameraMovementSystem>();
+
+	projectileEmitSystem.setProjectilePrefab(registry->getPrefab("bullet"));
+
+	if (registry->getStorageMode() == SPARSE_SET_STORAGE) {
+		movementSystem.setMovingEntities(registry->owningGroup<const TransformComponent, const RigidBodyComponent>());
+	}
+
+	scheduler->addSystem(movementSystem, [this, &movementSystem]() { movementSystem.update(deltaTime); });
+	scheduler->addSystem(hierarchySystem, [&hierarchySystem]() { hierarchySystem.update(); });
+	scheduler->addSystem(animationSystem, [&animationSystem]() { animationSystem.update(); });
+	scheduler->addSystem(collisionSystem, [this, &collisionSystem]() { collisionSystem.update(eventBus); });
+	scheduler->addSystem(projectileEmitSystem, [this, &projectileEmitSystem]() { projectileEmitSystem.update(registry); });
+	scheduler->addSystem(projectileLifecycleSystem, [&projectileLifecycleSystem]() { projectileLifecycleSystem.update(); });
+	scheduler->addSystem(cameraMovementSystem, [this, &cameraMovementSystem]() { cameraMovementSystem.update(camera); });
+
+	// Adding assets, the images are decoded in the background while the rest of
+	// the level loads. Headless games never render, so they skip them.
+	if (!isHeadless) {
+		assetStore->addTextureAsync("tank-image", "./assets/images/tank-panther-right.png");
+		assetStore->addTextureAsync("truck-image", "./assets/images/truck-ford-right.png");
+		assetStore->addTextureAsync("chopper-image", "./assets/images/chopper-spritesheet.png");
+		assetStore->addTextureAsync("radar-image", "./assets/images/radar.png");
+		assetStore->addTextureAsync("tilemap-image", "./assets/tilemaps/jungle.png");
+		assetStore->addTextureAsync("bullet-image", "./assets/images/bullet.png");
+		assetStore->addTextureAsync("tree-image", "./assets/images/tree.png");
+		assetStore->addFont("charriot-font-20", "./assets/fonts/charriot.ttf", 20);
+		assetStore->addFont("pico8-font-5", "./assets/fonts/pico8.ttf", 5);
+		assetStore->addFont("pico8-font-10", "./assets/fonts/pico8.ttf", 10);
+	}
 
 	int tileSize = 32;
 	double tileScale = 2.0;
@@ -229,6 +325,106 @@ void Game::loadLevel(int level) {
 	Entity label = registry->createEntity();
 	SDL_Color white = {255, 255, 255};
 	label.addComponent<TextLabelComponent>(glm::vec2(windowWidth/2-40, 10), "CHOPPER 1.0", "charriot-font-20", white, true);
+
+	// Textures are created on the render thread once the decoding jobs are done
+	if (!isHeadless) {
+		assetStore->waitForTextures(renderer);
+	}
+
+	if (hasSnapshots) {
+		registry->saveSnapshot(levelStartSnapshot);
+	}
+	levelStartTicks = Clock::getTicks();
+}
+
+// A quick save file is the game time it was saved at followed by the snapshot
+static bool readQuickSaveFile(InputQuickSave& quickSave) {
+	std::ifstream file(QUICKSAVE_PATH, std::ios::binary | std::ios::ate);
+
+	if (!file) {
+		return false;
+	}
+
+	const size_t fileSize = static_cast<size_t>(file.tellg());
+	if (fileSize < sizeof(quickSave.ticks)) {
+		return false;
+	}
+
+	auto bytes = std::make_shared<std::vector<unsigned char>>(fileSize - sizeof(quickSave.ticks));
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(&quickSave.ticks), sizeof(quickSave.ticks));
+	file.read(reinterpret_cast<char*>(bytes->data()), bytes->size());
+
+	if (!file) {
+		return false;
+	}
+
+	quickSave.snapshotBytes = bytes;
+	return true;
+}
+
+void Game::quickSave() {
+	// Commands recorded by the last frame aren't part of snapshots
+	registry->update();
+
+	RegistrySnapshot snapshot;
+	if (!registry->saveSnapshot(snapshot)) {
+		return;
+	}
+
+	// Replays still pay for the save but leave the quick save of the player alone
+	std::vector<unsigned char> bytes;
+	SnapshotWriter writer(bytes);
+	writer.write(Clock::getTicks());
+	snapshot.write(bytes);
+
+	if (inputReplay) {
+		return;
+	}
+
+	std::ofstream file(QUICKSAVE_PATH, std::ios::binary);
+	file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+
+	if (!file) {
+		Logger::error("Error writing " + QUICKSAVE_PATH);
+		return;
+	}
+
+	Logger::info("Quick saved " + std::to_string(bytes.size()) + " bytes");
+}
+
+void Game::quickLoad() {
+	// Replays load the quick saves the recorded session loaded, in their order
+	InputQuickSave quickSave;
+	if (inputReplay) {
+		if (numReplayedQuickLoads < replayFrame.quickLoads.size()) {
+			quickSave = replayFrame.quickLoads[numReplayedQuickLoads++];
+		}
+	} else {
+		readQuickSaveFile(quickSave);
+		if (inputRecorder) {
+			inputRecorder->recordQuickLoad(quickSave);
+		}
+	}
+
+	if (!quickSave.snapshotBytes) {
+		Logger::error("No quick save to load");
+		return;
+	}
+
+	RegistrySnapshot snapshot;
+	if (!snapshot.read(quickSave.snapshotBytes) || !registry->loadSnapshot(snapshot)) {
+		Logger::error("Error loading " + QUICKSAVE_PATH);
+		return;
+	}
+
+	Clock::setTicks(quickSave.ticks);
+}
+
+void Game::restartLevel() {
+	if (registry->loadSnapshot(levelStartSnapshot)) {
+		Clock::setTicks(levelStartTicks);
+	}
 }
 
 void Game::setup() {
@@ -236,45 +432,122 @@ void Game::setup() {
 }
 
 void Game::update() {
+	// Replays take the frame time from the log instead of the wall clock
+	uint32_t deltaMillisecs = 0;
+
+	if (inputReplay) {
+		deltaMillisecs = replayFrame.deltaMillisecs;
+	} else if (currentTicks >= skipTicks) {
+		// If we are too fast, waste some time until we reach the MILLISECS_PER_FRAME
+		int timeToWait = MILLISECS_PER_FRAME - (SDL_GetTicks() - millisecsPreviousFrame);
+		if (timeToWait > 0 && timeToWait <= MILLISECS_PER_FRAME) {
+			SDL_Delay(timeToWait);
+		}
+
+		deltaMillisecs = SDL_GetTicks() - millisecsPreviousFrame;
+
+		// Store the "previous" frame time
+		millisecsPreviousFrame = SDL_GetTicks();
+	}
+
+	if (inputRecorder) {
+		inputRecorder->recordFrame(deltaMillisecs);
+	}
+
 	if (currentTicks < skipTicks) {
 		currentTicks++;
 		return;
 	}
 
-	// If we are too fast, waste some time until we reach the MILLISECS_PER_FRAME
-    int timeToWait = MILLISECS_PER_FRAME - (SDL_GetTicks() - millisecsPreviousFrame);
-    if (timeToWait > 0 && timeToWait <= MILLISECS_PER_FRAME) {
-        SDL_Delay(timeToWait);
-    }
+	// The difference in ticks since the last frame, converted to seconds
+	deltaTime = deltaMillisecs / 1000.0;
 
-    // The difference in ticks since the last frame, converted to seconds
-    double deltaTime = (SDL_GetTicks() - millisecsPreviousFrame) / 1000.0;
+	if (!inputReplay) {
+		simulateFrame();
+		return;
+	}
 
-    // Store the "previous" frame time
-    millisecsPreviousFrame = SDL_GetTicks();
-   
-    // Reset all event handlers for the current frame
-    eventBus->reset();
+	const Uint64 start = SDL_GetPerformanceCounter();
+	simulateFrame();
+	const double frameMillisecs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
 
-    // Perform the subscription of the events for all systems
-    registry->getSystem<MovementSystem>().subscribeToEvents(eventBus);
-    registry->getSystem<DamageSystem>().subscribeToEvents(eventBus);
-    registry->getSystem<KeyboardControlSystem>().subscribeToEvents(eventBus);
-    registry->getSystem<ProjectileEmitSystem>().subscribeToEvents(eventBus);
+	numReplayedFrames++;
+	replayedMillisecs += frameMillisecs;
+	slowestReplayedFrameMillisecs = std::max(slowestReplayedFrameMillisecs, frameMillisecs);
+}
 
-    // Update the registry to process the entities that are waiting to be created/deleted
-    registry->update();
-    
-    // Invoke all the systems that need to update 
-    registry->getSystem<MovementSystem>().update(deltaTime);
-    registry->getSystem<AnimationSystem>().update();
-    registry->getSystem<CollisionSystem>().update(eventBus);
-    registry->getSystem<ProjectileEmitSystem>().update(registry);
-    registry->getSystem<ProjectileLifecycleSystem>().update();
-    registry->getSystem<CameraMovementSystem>().update(camera);
+void Game::simulateFrame() {
+	// Game time only moves with the simulated frames
+	Clock::advance(static_cast<uint32_t>(std::lround(deltaTime * 1000.0)));
+
+	// Update the registry to process the entities that are waiting to be created/deleted
+	registry->update();
+
+	// Keep the frame for rewinds and rollbacks. It's saved once the command
+	// buffers are applied, so nothing of the frame lives outside the registry
+	frameDeltaTimes[frame % ROLLBACK_FRAMES] = deltaTime;
+	frameTicks[frame % ROLLBACK_FRAMES] = Clock::getTicks();
+	if (hasSnapshots) {
+		rollbackBuffer.save(*registry, frame);
+	}
+	frame++;
+
+	// Invoke all the systems that need to update
+	scheduler->update();
+}
+
+// Goes back to the state at the end of an earlier frame: restores the frame,
+// saved before its systems ran, and runs them again
+void Game::rewind(int frames) {
+	const int targetFrame = std::max(frame - 1 - frames, 0);
+
+	if (!rollbackBuffer.restore(*registry, targetFrame)) {
+		Logger::error("Frame " + std::to_string(targetFrame) + " isn't in the rollback buffer anymore");
+		return;
+	}
+
+	frame = targetFrame + 1;
+	Clock::setTicks(frameTicks[targetFrame % ROLLBACK_FRAMES]);
+
+	const double currentDeltaTime = deltaTime;
+	deltaTime = frameDeltaTimes[targetFrame % ROLLBACK_FRAMES];
+	scheduler->update();
+	deltaTime = currentDeltaTime;
+}
+
+// Rewinds and simulates the same frames again with their delta times, as a
+// rollback does when late input arrives. Inputs aren't replayed.
+void Game::rollback(int frames) {
+	const int lastFrame = frame;
+	const double currentDeltaTime = deltaTime;
+	const Uint64 start = SDL_GetPerformanceCounter();
+
+	rewind(frames);
+	while (frame < lastFrame) {
+		deltaTime = frameDeltaTimes[frame % ROLLBACK_FRAMES];
+		simulateFrame();
+	}
+
+	deltaTime = currentDeltaTime;
+	const double elapsedMillisecs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+	Logger::info("Rolled back " + std::to_string(frames) + " frames in " + std::to_string(elapsedMillisecs) + " ms, the frame budget is " + std::to_string(MILLISECS_PER_FRAME) + " ms");
 }
 
 void Game::processInput() {
+	// Replays press the recorded keys of the next frame, and stop at the end of the log
+	if (inputReplay) {
+		if (!inputReplay->readFrame(replayFrame)) {
+			isRunning = false;
+			return;
+		}
+		numReplayedQuickLoads = 0;
+
+		for (auto key: replayFrame.keys) {
+			onKeyPressed(key);
+		}
+		return;
+	}
+
 	SDL_Event sdlEvent;
 	while(SDL_PollEvent(&sdlEvent)) {
 		// ImGui SDL Input
@@ -293,30 +566,53 @@ void Game::processInput() {
 				isRunning = false;
 				break;
 			case SDL_KEYDOWN:
-				if (sdlEvent.key.keysym.sym == SDLK_ESCAPE) {
-					isRunning = false;
-				}
-				if (sdlEvent.key.keysym.sym == SDLK_d) {
-					isDebug = !isDebug;
-				}
-				eventBus->emit<KeyPressedEvent>(sdlEvent.key.keysym.sym);
+				onKeyPressed(sdlEvent.key.keysym.sym);
 				break;
 		}
 	}
 }
+
+void Game::onKeyPressed(SDL_Keycode key) {
+	if (inputRecorder) {
+		inputRecorder->recordKeyPressed(key);
+	}
+
+	if (key == SDLK_ESCAPE) {
+		isRunning = false;
+	}
+	if (key == SDLK_d) {
+		isDebug = !isDebug;
+	}
+	if (hasSnapshots) {
+		if (key == SDLK_F5) {
+			quickSave();
+		}
+		if (key == SDLK_F9) {
+			quickLoad();
+		}
+		if (key == SDLK_r) {
+			restartLevel();
+		}
+		if (key == SDLK_BACKSPACE) {
+			rewind(ROLLBACK_FRAMES - 1);
+		}
+		if (key == SDLK_F6) {
+			rollback(ROLLBACK_RESIMULATED_FRAMES);
+		}
+	}
+	eventBus->emit<KeyPressedEvent>(key);
+}
 	
 void Game::render() {
 	SDL_SetRenderDrawColor(renderer,21,21,21,255);
 	SDL_RenderClear(renderer);
 
-	registry->getSystem<RenderSystem>().update(renderer, assetStore, camera);
-	registry->getSystem<RenderTextSystem>().update(renderer, assetStore, camera);
-	registry->getSystem<RenderHealthBarSystem>().update(renderer, assetStore, camera);
+	systems->render.forEach([this](auto& system) { system.update(renderer, assetStore, camera); });
 
 	// Update Render Collider System
 	if (isDebug) {
-		registry->getSystem<RenderColliderSystem>().update(renderer, camera);
-		registry->getSystem<RenderGUISystem>().update(registry, camera);
+		systems->debugRender.get<RenderColliderSystem>().update(renderer, camera);
+		systems->debugRender.get<RenderGUISystem>().update(registry, camera);
 	}
 
 
@@ -328,15 +624,30 @@ void Game::run() {
 
 	while(isRunning) {
 		processInput();
+		if (!isRunning) {
+			break;
+		}
+
 		update();
-		render();
+		if (!isHeadless) {
+			render();
+		}
+	}
+
+	// Frame costs of the replay, to compare engine builds on the same session
+	if (inputReplay && numReplayedFrames > 0) {
+		Logger::info("Replayed " + std::to_string(numReplayedFrames) + " frames in " + std::to_string(replayedMillisecs) + " ms, " +
+			std::to_string(replayedMillisecs / numReplayedFrames) + " ms per frame on average, " +
+			std::to_string(slowestReplayedFrameMillisecs) + " ms for the slowest");
 	}
 }
 
 void Game::destroy() {
-	ImGuiSDL::Deinitialize();
-	ImGui::DestroyContext();
-	SDL_DestroyRenderer(renderer);
-	SDL_DestroyWindow(window);
+	if (!isHeadless) {
+		ImGuiSDL::Deinitialize();
+		ImGui::DestroyContext();
+		SDL_DestroyRenderer(renderer);
+		SDL_DestroyWindow(window);
+	}
 	SDL_Quit();
 }
\ No newline at end of file
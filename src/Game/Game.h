@@ -2,16 +2,27 @@
 #define GAME_H
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <SDL2/SDL.h>
 
 #include "../ECS/ECS.h"
 #include "../AssetStore/AssetStore.h"
 #include "../EventBus/EventBus.h"
+#include "../JobSystem/JobSystem.h"
+#include "../Scheduler/Scheduler.h"
+#include "../InputLog/InputLog.h"
 
 // Constants
 const int FPS = 120;
 const int MILLISECS_PER_FRAME = 1000 / FPS;
+const std::string QUICKSAVE_PATH = "./quicksave.snapshot";
+const int ROLLBACK_FRAMES = FPS;
+const int ROLLBACK_RESIMULATED_FRAMES = 8;
+
+// Systems of the frame pipeline, defined in Game.cpp where the systems are known
+struct GameSystems;
 
 // Game class
 class Game {
@@ -19,26 +30,68 @@ class Game {
 private:
 	bool isRunning;
 	bool isDebug;
+	bool isHeadless = false;
 	int millisecsPreviousFrame;
+	double deltaTime;
 	SDL_Window* window;
 	SDL_Renderer* renderer;
 	SDL_Rect camera;
 
+	// Declared first so it outlives everything that runs jobs on it
+	std::unique_ptr<JobSystem> jobSystem;
 	std::unique_ptr<Registry> registry;
 	std::unique_ptr<AssetStore> assetStore;
 	std::unique_ptr<EventBus> eventBus;
+	std::unique_ptr<Scheduler> scheduler;
+	std::unique_ptr<GameSystems> systems;
+
+	// Snapshots only support sparse set storage. With archetypes there are no
+	// quick saves, restarts, rewinds or rollbacks.
+	bool hasSnapshots;
+
+	// State of the world and game time right after the level loaded, for restarts
+	RegistrySnapshot levelStartSnapshot;
+	uint32_t levelStartTicks = 0;
+
+	// The last second of frames, saved before their systems ran, with the
+	// delta time and the game time the systems ran with
+	int frame = 0;
+	RollbackBuffer rollbackBuffer;
+	std::vector<double> frameDeltaTimes;
+	std::vector<uint32_t> frameTicks;
+
+	// Input of the session, recorded to a log or replayed from one. Replays
+	// run headless and as fast as they can, timing the frames.
+	std::unique_ptr<InputRecorder> inputRecorder;
+	std::unique_ptr<InputReplay> inputReplay;
+	InputFrame replayFrame;
+	size_t numReplayedQuickLoads = 0;
+	int numReplayedFrames = 0;
+	double replayedMillisecs = 0;
+	double slowestReplayedFrameMillisecs = 0;
 
 public:
-	Game();
+	Game(StorageMode storageMode = SPARSE_SET_STORAGE);
 	~Game();
 
+	// Called before initialize()
+	bool recordInput(const std::string& filePath);
+	bool replayInput(const std::string& filePath);
+
 	void initialize();
 	void loadLevel(int level);
 	void setup();
 	void run();
 	void processInput();
+	void onKeyPressed(SDL_Keycode key);
 	void update();
+	void simulateFrame();
+	void rewind(int frames);
+	void rollback(int frames);
 	void render();
+	void quickSave();
+	void quickLoad();
+	void restartLevel();
 	void destroy();
 
 	int currentTicks = 0;
@@ -0,0 +1,135 @@
+#include "InputLog.h"
+#include "../ECS/ECS.h"
+#include "../Logger/Logger.h"
+
+static const uint32_t INPUT_LOG_MAGIC = 0x4c504e49;
+static const uint32_t INPUT_LOG_VERSION = 2;
+
+// Set in the key count of frames that loaded quick saves
+static const uint16_t HAS_QUICK_LOADS = 0x8000;
+static const uint16_t MAX_KEYS_PER_FRAME = HAS_QUICK_LOADS - 1;
+
+bool InputRecorder::open(const std::string& filePath) {
+	file.open(filePath, std::ios::binary | std::ios::trunc);
+
+	if (!file) {
+		Logger::error("Error opening " + filePath + " to record the input");
+		return false;
+	}
+
+	file.write(reinterpret_cast<const char*>(&INPUT_LOG_MAGIC), sizeof(INPUT_LOG_MAGIC));
+	file.write(reinterpret_cast<const char*>(&INPUT_LOG_VERSION), sizeof(INPUT_LOG_VERSION));
+	Logger::info("Recording the input to " + filePath);
+	return true;
+}
+
+void InputRecorder::recordKeyPressed(SDL_Keycode key) {
+	frame.keys.push_back(key);
+}
+
+void InputRecorder::recordQuickLoad(const InputQuickSave& quickSave) {
+	frame.quickLoads.push_back(quickSave);
+}
+
+void InputRecorder::recordFrame(uint32_t deltaMillisecs) {
+	if (!file.is_open()) {
+		return;
+	}
+
+	if (frame.keys.size() > MAX_KEYS_PER_FRAME) {
+		Logger::error("Too many keys pressed in a frame to record them all");
+		frame.keys.resize(MAX_KEYS_PER_FRAME);
+	}
+
+	bytes.clear();
+	SnapshotWriter writer(bytes);
+	writer.write<uint32_t>(deltaMillisecs);
+	writer.write<uint16_t>(frame.keys.size() | (frame.quickLoads.empty() ? 0 : HAS_QUICK_LOADS));
+	for (auto key: frame.keys) {
+		writer.write<int32_t>(key);
+	}
+
+	if (!frame.quickLoads.empty()) {
+		writer.write<uint16_t>(frame.quickLoads.size());
+		for (auto& quickSave: frame.quickLoads) {
+			const size_t size = quickSave.snapshotBytes ? quickSave.snapshotBytes->size() : 0;
+			writer.write<uint32_t>(quickSave.ticks);
+			writer.write<uint64_t>(size);
+			if (size > 0) {
+				writer.write(quickSave.snapshotBytes->data(), size);
+			}
+		}
+	}
+
+	file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+	frame.keys.clear();
+	frame.quickLoads.clear();
+}
+
+bool InputReplay::open(const std::string& filePath) {
+	std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+
+	if (!file) {
+		Logger::error("Error opening the input log " + filePath);
+		return false;
+	}
+
+	bytes.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+
+	SnapshotReader reader(bytes.data(), bytes.size());
+	uint32_t magic = 0;
+	uint32_t version = 0;
+
+	if (!file || !reader.read(magic) || !reader.read(version) || magic != INPUT_LOG_MAGIC || version != INPUT_LOG_VERSION) {
+		Logger::error("Invalid input log " + filePath);
+		return false;
+	}
+
+	offset = sizeof(magic) + sizeof(version);
+	Logger::info("Replaying the input of " + filePath);
+	return true;
+}
+
+bool InputReplay::readFrame(InputFrame& frame) {
+	SnapshotReader reader(bytes.data() + offset, bytes.size() - offset);
+	uint32_t deltaMillisecs = 0;
+	uint16_t keyCount = 0;
+
+	if (!reader.read(deltaMillisecs) || !reader.read(keyCount)) {
+		return false;
+	}
+
+	const uint16_t numKeys = keyCount & MAX_KEYS_PER_FRAME;
+	if (reader.getRemainingSize() / sizeof(int32_t) < numKeys) {
+		return false;
+	}
+
+	frame.deltaMillisecs = deltaMillisecs;
+	frame.keys.resize(numKeys);
+	for (auto& key: frame.keys) {
+		int32_t value = 0;
+		reader.read(value);
+		key = value;
+	}
+
+	uint16_t numQuickLoads = 0;
+	if ((keyCount & HAS_QUICK_LOADS) && !reader.read(numQuickLoads)) {
+		return false;
+	}
+
+	frame.quickLoads.resize(numQuickLoads);
+	for (auto& quickSave: frame.quickLoads) {
+		uint64_t size = 0;
+		if (!reader.read(quickSave.ticks) || !reader.read(size) || size > reader.getRemainingSize()) {
+			return false;
+		}
+
+		const unsigned char* snapshotBytes = reader.skip(size);
+		quickSave.snapshotBytes = size > 0 ? std::make_shared<const std::vector<unsigned char>>(snapshotBytes, snapshotBytes + size) : nullptr;
+	}
+
+	offset = bytes.size() - reader.getRemainingSize();
+	return true;
+}
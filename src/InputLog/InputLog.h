@@ -0,0 +1,65 @@
+#ifndef INPUTLOG_H
+#define INPUTLOG_H
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <SDL2/SDL.h>
+
+// A quick save file as it was loaded: the game time it was saved at and the
+// registry snapshot. No snapshot bytes when there was no quick save to load.
+struct InputQuickSave {
+	uint32_t ticks = 0;
+	std::shared_ptr<const std::vector<unsigned char>> snapshotBytes;
+};
+
+// Everything a frame of the game takes from outside the simulation: the keys
+// pressed before it, its delta time and the quick saves its keys loaded, which
+// replays take from the log since the file may have changed since
+struct InputFrame {
+	uint32_t deltaMillisecs = 0;
+	std::vector<SDL_Keycode> keys;
+	std::vector<InputQuickSave> quickLoads;
+};
+
+// Writes the frames to a binary log as they're played. A frame takes a
+// uint32 delta time, a uint16 key count and an int32 per key, so an idle frame
+// is 6 bytes. The top bit of the key count marks frames that loaded quick
+// saves, followed by their uint16 count and a uint32 time, a uint64 size and
+// the snapshot bytes for each.
+class InputRecorder {
+
+private:
+	std::ofstream file;
+	InputFrame frame;
+	std::vector<unsigned char> bytes;
+
+public:
+	bool open(const std::string& filePath);
+
+	void recordKeyPressed(SDL_Keycode key);
+	void recordQuickLoad(const InputQuickSave& quickSave);
+
+	// Writes the keys recorded since the previous frame with the delta time
+	void recordFrame(uint32_t deltaMillisecs);
+
+};
+
+// Reads a log written by an InputRecorder back one frame at a time
+class InputReplay {
+
+private:
+	std::vector<unsigned char> bytes;
+	size_t offset = 0;
+
+public:
+	bool open(const std::string& filePath);
+
+	// False at the end of the log or when the rest of it is cut short
+	bool readFrame(InputFrame& frame);
+
+};
+
+#endif
@@ -0,0 +1,335 @@
+#include "JobSystem.h"
+#include "../Logger/Logger.h"
+
+#include <cstdlib>
+
+// Queue of the calling thread, only meaningful when threadJobSystem is the
+// job system asking
+static thread_local JobSystem* threadJobSystem = nullptr;
+static thread_local int threadQueueIndex = 0;
+
+// Attempts to find a job before a waiting thread goes to sleep
+static const int NUM_WAIT_SPINS = 64;
+
+static std::atomic<bool> isThreadSlotTaken[MAX_THREAD_SLOTS];
+
+// Gives the slot back when its thread exits
+struct ThreadSlotHolder {
+	int slot = -1;
+
+	~ThreadSlotHolder() {
+		if (slot >= 0) {
+			isThreadSlotTaken[slot].store(false);
+		}
+	}
+};
+
+static thread_local ThreadSlotHolder threadSlot;
+
+// Slot of the innermost ThreadSlotScope of the thread, -1 outside of one
+static thread_local int scopedThreadSlot = -1;
+
+[[noreturn]] static void abortOnMissingSlots() {
+	Logger::error("More than " + std::to_string(MAX_THREAD_SLOTS) + " thread slots are in use");
+	std::abort();
+}
+
+int ThreadSlots::get() {
+	if (scopedThreadSlot >= 0) {
+		return scopedThreadSlot;
+	}
+
+	if (threadSlot.slot >= 0) {
+		return threadSlot.slot;
+	}
+
+	for (int slot = 0; slot < static_cast<int>(MAX_THREAD_SLOTS); slot++) {
+		bool isTaken = false;
+		if (isThreadSlotTaken[slot].compare_exchange_strong(isTaken, true)) {
+			threadSlot.slot = slot;
+			return slot;
+		}
+	}
+
+	abortOnMissingSlots();
+}
+
+int ThreadSlots::reserve(int count) {
+	// Threads take the lowest slots, so the highest range stays the same from
+	// run to run and the reserved slots keep their order against the threads
+	for (int firstSlot = static_cast<int>(MAX_THREAD_SLOTS) - count; firstSlot >= 0; firstSlot--) {
+		int numTaken = 0;
+		for (; numTaken < count; numTaken++) {
+			bool isTaken = false;
+			if (!isThreadSlotTaken[firstSlot + numTaken].compare_exchange_strong(isTaken, true)) {
+				break;
+			}
+		}
+
+		if (numTaken == count) {
+			return firstSlot;
+		}
+		release(firstSlot, numTaken);
+	}
+
+	abortOnMissingSlots();
+}
+
+void ThreadSlots::release(int firstSlot, int count) {
+	for (int slot = firstSlot; slot < firstSlot + count; slot++) {
+		isThreadSlotTaken[slot].store(false);
+	}
+}
+
+ThreadSlotScope::ThreadSlotScope(int slot): previousSlot(scopedThreadSlot) {
+	scopedThreadSlot = slot;
+}
+
+ThreadSlotScope::~ThreadSlotScope() {
+	scopedThreadSlot = previousSlot;
+}
+
+JobCounter::JobCounter(JobCounter* parent): parent(parent) {
+}
+
+bool JobCounter::isDone() const {
+	return numPendingJobs.load() == 0;
+}
+
+JobSystem::JobSystem(int numWorkers) {
+	if (numWorkers <= 0) {
+		numWorkers = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+		numWorkers = std::min(numWorkers, static_cast<int>(MAX_THREAD_SLOTS) / 2);
+	}
+
+	// Before any worker, so the owning thread gets the lowest free slot
+	ThreadSlots::get();
+
+	for (int priority = 0; priority < NUM_JOB_PRIORITIES; priority++) {
+		numQueuedJobs[priority].store(0);
+	}
+	maxRunningLowPriorityJobs = numWorkers - 1;
+
+	for (int i = 0; i <= numWorkers; i++) {
+		queues.push_back(std::make_unique<JobQueue>());
+	}
+
+	threadJobSystem = this;
+	threadQueueIndex = 0;
+
+	for (int i = 1; i <= numWorkers; i++) {
+		workers.emplace_back(&JobSystem::workerLoop, this, i);
+	}
+
+	Logger::info("JobSystem started with " + std::to_string(numWorkers) + " workers");
+}
+
+JobSystem::~JobSystem() {
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		isStopping = true;
+	}
+	jobAvailable.notify_all();
+
+	for (auto& worker: workers) {
+		worker.join();
+	}
+
+	if (threadJobSystem == this) {
+		threadJobSystem = nullptr;
+	}
+}
+
+int JobSystem::getNumThreads() const {
+	return static_cast<int>(queues.size());
+}
+
+int JobSystem::getThreadIndex() const {
+	return threadJobSystem == this ? threadQueueIndex : 0;
+}
+
+void JobSystem::run(std::function<void()> function, JobCounter* counter, JobPriority priority) {
+	// The first pending job of a counter makes its parent pending as well
+	for (JobCounter* pending = counter; pending && pending->numPendingJobs.fetch_add(1) == 0; ) {
+		pending = pending->parent;
+	}
+
+	JobQueue& queue = *queues[getThreadIndex()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs[priority].push_back(Job{std::move(function), counter, priority, false});
+	}
+	numQueuedJobs[priority]++;
+
+	wakeWorker();
+	wakeWaiters();
+}
+
+void JobSystem::wait(const JobCounter& counter, JobPriority lowestPriority) {
+	const int queueIndex = getThreadIndex();
+	int numSpins = 0;
+
+	while (!counter.isDone()) {
+		Job job;
+		if (takeJob(queueIndex, lowestPriority, false, job)) {
+			execute(job);
+			numSpins = 0;
+			continue;
+		}
+
+		if (++numSpins < NUM_WAIT_SPINS) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		// The jobs left are running elsewhere, sleep until one of them is done
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		numParkedWaiters++;
+		waitProgress.wait(lock, [this, &counter, lowestPriority]() {
+			return counter.isDone() || numQueuedJobs[JOB_HIGH_PRIORITY].load() > 0 ||
+				(lowestPriority == JOB_LOW_PRIORITY && numQueuedJobs[JOB_LOW_PRIORITY].load() > 0);
+		});
+		numParkedWaiters--;
+		numSpins = 0;
+	}
+}
+
+bool JobSystem::popJob(int queueIndex, JobPriority priority, Job& job) {
+	JobQueue& queue = *queues[queueIndex];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+
+	auto& jobs = queue.jobs[priority];
+	if (jobs.empty()) {
+		return false;
+	}
+
+	job = std::move(jobs.back());
+	jobs.pop_back();
+	numQueuedJobs[priority]--;
+	return true;
+}
+
+bool JobSystem::stealJob(int thiefIndex, JobPriority priority, Job& job) {
+	const int numQueues = getNumThreads();
+
+	for (int i = 1; i < numQueues; i++) {
+		JobQueue& queue = *queues[(thiefIndex + i) % numQueues];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		auto& jobs = queue.jobs[priority];
+		if (!jobs.empty()) {
+			job = std::move(jobs.front());
+			jobs.pop_front();
+			numQueuedJobs[priority]--;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool JobSystem::takeJob(int queueIndex, JobPriority lowestPriority, bool isWorker, Job& job) {
+	if (numQueuedJobs[JOB_HIGH_PRIORITY].load() > 0) {
+		if (popJob(queueIndex, JOB_HIGH_PRIORITY, job) || stealJob(queueIndex, JOB_HIGH_PRIORITY, job)) {
+			return true;
+		}
+	}
+
+	if (lowestPriority != JOB_LOW_PRIORITY || numQueuedJobs[JOB_LOW_PRIORITY].load() == 0) {
+		return false;
+	}
+
+	// A thread waiting for background jobs runs them whatever the cap
+	if (!isWorker) {
+		return popJob(queueIndex, JOB_LOW_PRIORITY, job) || stealJob(queueIndex, JOB_LOW_PRIORITY, job);
+	}
+
+	// Reserve a background slot before looking for a low priority job
+	int numRunning = numRunningLowPriorityJobs.load();
+	do {
+		if (numRunning >= maxRunningLowPriorityJobs) {
+			return false;
+		}
+	} while (!numRunningLowPriorityJobs.compare_exchange_weak(numRunning, numRunning + 1));
+
+	if (popJob(queueIndex, JOB_LOW_PRIORITY, job) || stealJob(queueIndex, JOB_LOW_PRIORITY, job)) {
+		job.holdsLowPrioritySlot = true;
+		return true;
+	}
+
+	numRunningLowPriorityJobs--;
+	return false;
+}
+
+bool JobSystem::hasTakeableJobs() const {
+	return numQueuedJobs[JOB_HIGH_PRIORITY].load() > 0 ||
+		(numQueuedJobs[JOB_LOW_PRIORITY].load() > 0 && numRunningLowPriorityJobs.load() < maxRunningLowPriorityJobs);
+}
+
+void JobSystem::execute(Job& job) {
+	job.function();
+	finishJob(job.counter);
+
+	if (job.holdsLowPrioritySlot) {
+		numRunningLowPriorityJobs--;
+
+		// A queued background job may have been waiting for this slot
+		if (numQueuedJobs[JOB_LOW_PRIORITY].load() > 0) {
+			wakeWorker();
+		}
+	}
+}
+
+void JobSystem::finishJob(JobCounter* counter) {
+	bool isCounterDone = false;
+
+	while (counter) {
+		// The counter may be gone as soon as it reaches zero
+		JobCounter* parent = counter->parent;
+		if (counter->numPendingJobs.fetch_sub(1) != 1) {
+			break;
+		}
+		isCounterDone = true;
+		counter = parent;
+	}
+
+	if (isCounterDone) {
+		wakeWaiters();
+	}
+}
+
+void JobSystem::wakeWorker() {
+	if (numSleepingWorkers.load() > 0) {
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		jobAvailable.notify_one();
+	}
+}
+
+void JobSystem::wakeWaiters() {
+	if (numParkedWaiters.load() > 0) {
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		waitProgress.notify_all();
+	}
+}
+
+void JobSystem::workerLoop(int queueIndex) {
+	threadJobSystem = this;
+	threadQueueIndex = queueIndex;
+
+	while (true) {
+		Job job;
+		if (takeJob(queueIndex, JOB_LOW_PRIORITY, true, job)) {
+			execute(job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		numSleepingWorkers++;
+		jobAvailable.wait(lock, [this]() { return isStopping.load() || hasTakeableJobs(); });
+		numSleepingWorkers--;
+
+		if (isStopping && !hasTakeableJobs()) {
+			return;
+		}
+	}
+}
@@ -0,0 +1,189 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads that record commands or events get a buffer slot of their own
+const unsigned int MAX_THREAD_SLOTS = 64;
+
+// Slots are taken on first use, lowest free one first, and given back when the
+// thread exits, so threads coming and going never run out of them. The thread
+// that creates the job system takes slot 0. More than MAX_THREAD_SLOTS threads
+// holding a slot at once is a fatal error, two threads never share one
+class ThreadSlots {
+
+public:
+	// Slot of the calling thread, or the one of its innermost ThreadSlotScope
+	static int get();
+
+	// Reserves count consecutive slots held by no thread, the highest free ones,
+	// and returns the first. Work that must record into the same slot whichever
+	// thread runs it uses them through a ThreadSlotScope. Running out is fatal.
+	static int reserve(int count);
+	static void release(int firstSlot, int count);
+
+};
+
+// Makes the calling thread record into a reserved slot until the scope ends.
+// Only one thread at a time may be in a scope of the same slot.
+class ThreadSlotScope {
+
+private:
+	int previousSlot;
+
+public:
+	explicit ThreadSlotScope(int slot);
+	~ThreadSlotScope();
+
+	ThreadSlotScope(const ThreadSlotScope&) = delete;
+	ThreadSlotScope& operator=(const ThreadSlotScope&) = delete;
+
+};
+
+// Frame critical jobs always run before background jobs such as asset decoding
+enum JobPriority {
+	JOB_HIGH_PRIORITY,
+	JOB_LOW_PRIORITY,
+	NUM_JOB_PRIORITIES
+};
+
+// Number of unfinished jobs run against the counter. A counter with a parent
+// keeps the parent unfinished while it has jobs of its own, so waiting on the
+// parent also waits for every child counter. A counter must outlive its jobs
+class JobCounter {
+
+private:
+	std::atomic<int> numPendingJobs{0};
+	JobCounter* parent;
+
+	friend class JobSystem;
+
+public:
+	JobCounter(JobCounter* parent = nullptr);
+
+	JobCounter(const JobCounter&) = delete;
+	JobCounter& operator=(const JobCounter&) = delete;
+
+	bool isDone() const;
+
+};
+
+// Work stealing job system. Every thread owns a queue of jobs (the thread that
+// creates the job system owns queue 0, other outside threads share it), pushes
+// and pops its own jobs from the back and steals from the front of the others.
+// The queues are plain deques behind a mutex each, not lock-free Chase-Lev
+// deques: jobs are whole systems, view chunks or texture decodes, so an
+// uncontended lock per push and pop is small next to the job itself
+class JobSystem {
+
+private:
+	struct Job {
+		std::function<void()> function;
+		JobCounter* counter;
+		JobPriority priority;
+		bool holdsLowPrioritySlot;
+	};
+
+	struct JobQueue {
+		std::mutex mutex;
+		std::deque<Job> jobs[NUM_JOB_PRIORITIES];
+	};
+
+	std::vector<std::unique_ptr<JobQueue>> queues;
+	std::vector<std::thread> workers;
+
+	std::atomic<int> numQueuedJobs[NUM_JOB_PRIORITIES];
+
+	// Workers never all run background jobs, one is always left for the frame.
+	// With a single worker that means none: background jobs then only run on
+	// the threads waiting for them, which take them regardless of this cap
+	std::atomic<int> numRunningLowPriorityJobs{0};
+	int maxRunningLowPriorityJobs;
+
+	std::mutex sleepMutex;
+	std::condition_variable jobAvailable;
+	std::atomic<int> numSleepingWorkers{0};
+	std::atomic<bool> isStopping{false};
+
+	// Threads in wait() park here once spinning found nothing to run
+	std::condition_variable waitProgress;
+	std::atomic<int> numParkedWaiters{0};
+
+	bool popJob(int queueIndex, JobPriority priority, Job& job);
+	bool stealJob(int thiefIndex, JobPriority priority, Job& job);
+	bool takeJob(int queueIndex, JobPriority lowestPriority, bool isWorker, Job& job);
+	bool hasTakeableJobs() const;
+	void execute(Job& job);
+	void finishJob(JobCounter* counter);
+	void wakeWorker();
+	void wakeWaiters();
+	void workerLoop(int queueIndex);
+
+public:
+	// Defaults to one worker per hardware thread, minus the calling thread, and
+	// leaves half of the thread slots to threads outside the job system
+	JobSystem(int numWorkers = 0);
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	void run(std::function<void()> function, JobCounter* counter = nullptr, JobPriority priority = JOB_HIGH_PRIORITY);
+
+	// Runs queued jobs on the calling thread until the counter is done. Only
+	// jobs up to the given priority are picked up, so waiting on frame work
+	// never gets stuck behind a long background job. When there is nothing to
+	// run the thread spins briefly, then sleeps until a job is queued or a
+	// counter is done
+	void wait(const JobCounter& counter, JobPriority lowestPriority = JOB_HIGH_PRIORITY);
+
+	// Splits [begin, end) in chunks of at least grainSize elements and calls
+	// function(chunkBegin, chunkEnd) on each of them, returning when all are done
+	template <typename TFunction> void parallelFor(int begin, int end, TFunction&& function, int grainSize = 1, JobPriority priority = JOB_HIGH_PRIORITY);
+
+	// Worker threads plus the owning thread
+	int getNumThreads() const;
+
+	// Index of the calling thread's queue, 0 for threads outside the job system
+	int getThreadIndex() const;
+
+};
+
+// TEMPLATES
+
+// JobSystem templates
+template <typename TFunction> void JobSystem::parallelFor(int begin, int end, TFunction&& function, int grainSize, JobPriority priority) {
+	const int count = end - begin;
+	if (count <= 0) {
+		return;
+	}
+
+	// Split in a few chunks per thread so stealing can even out uneven chunks
+	const int numChunks = getNumThreads() * 4;
+	const int chunkSize = std::max(std::max(grainSize, 1), (count + numChunks - 1) / numChunks);
+
+	if (count <= chunkSize) {
+		function(begin, end);
+		return;
+	}
+
+	JobCounter counter;
+	for (int chunkBegin = begin + chunkSize; chunkBegin < end; chunkBegin += chunkSize) {
+		const int chunkEnd = std::min(chunkBegin + chunkSize, end);
+		run([&function, chunkBegin, chunkEnd]() { function(chunkBegin, chunkEnd); }, &counter, priority);
+	}
+
+	// The first chunk runs on the calling thread
+	function(begin, begin + chunkSize);
+	wait(counter, priority);
+}
+
+#endif
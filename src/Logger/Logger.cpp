@@ -2,9 +2,13 @@
 #include <iostream>
 #include <iomanip>
 #include <ctime>
+#include <mutex>
 
 std::vector<LogEntry> Logger::messages;
 
+// Systems may log from worker threads
+static std::mutex logMutex;
+
 std::string getCurrentDateTime() {
 	time_t rawtime;
 	struct tm * timeinfo;
@@ -33,12 +37,14 @@ void printLog(LogEntry logEntry) {
 
 void Logger::info(const std::string& message) {
 	LogEntry logEntry = createLogMessage(LogLevel::INFO, message);
+	std::lock_guard<std::mutex> lock(logMutex);
 	printLog(logEntry);
 	Logger::messages.push_back(logEntry);
 }
 
 void Logger::error(const std::string& message) {
 	LogEntry logEntry = createLogMessage(LogLevel::ERROR, message);
+	std::lock_guard<std::mutex> lock(logMutex);
 	printLog(logEntry);
 	Logger::messages.push_back(logEntry);
 }
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <string>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_ttf.h>
@@ -10,7 +11,31 @@
 
 
 int main(int argc, char* argv[]) {
-    Game game;
+    // --archetypes runs the game with the archetype component storage
+    // --record <file> writes the input of the session to the file
+    // --replay <file> plays the recorded session back headless, as fast as possible
+    StorageMode storageMode = SPARSE_SET_STORAGE;
+    std::string recordPath;
+    std::string replayPath;
+    for (int i = 1; i < argc; i++) {
+        const std::string argument = argv[i];
+        if (argument == "--archetypes") {
+            storageMode = ARCHETYPE_STORAGE;
+        } else if (argument == "--record" && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (argument == "--replay" && i + 1 < argc) {
+            replayPath = argv[++i];
+        }
+    }
+
+    Game game(storageMode);
+    if (!recordPath.empty() && !game.recordInput(recordPath)) {
+        return 1;
+    }
+    if (!replayPath.empty() && !game.replayInput(replayPath)) {
+        return 1;
+    }
+
     game.initialize();
     game.run();
     game.destroy();
@@ -0,0 +1,86 @@
+#include "Scheduler.h"
+#include "../Logger/Logger.h"
+
+Scheduler::Scheduler(JobSystem& jobSystem): jobSystem(jobSystem) {
+}
+
+Scheduler::~Scheduler() {
+	ThreadSlots::release(firstThreadSlot, numThreadSlots);
+}
+
+void Scheduler::addSystem(System& system, std::function<void()> update) {
+	Task task;
+	task.system = &system;
+	task.update = std::move(update);
+	tasks.push_back(std::move(task));
+	isGraphDirty = true;
+}
+
+void Scheduler::buildGraph() {
+	int numDependencies = 0;
+
+	for (auto& task: tasks) {
+		task.dependents.clear();
+		task.numDependencies = 0;
+	}
+
+	// A system depends on every earlier system it conflicts with
+	for (size_t i = 0; i < tasks.size(); i++) {
+		for (size_t j = i + 1; j < tasks.size(); j++) {
+			if (tasks[i].system->conflictsWith(*tasks[j].system)) {
+				tasks[i].dependents.push_back(j);
+				tasks[j].numDependencies++;
+				numDependencies++;
+			}
+		}
+	}
+
+	ThreadSlots::release(firstThreadSlot, numThreadSlots);
+	numThreadSlots = tasks.size();
+	firstThreadSlot = ThreadSlots::reserve(numThreadSlots);
+	for (int i = 0; i < numThreadSlots; i++) {
+		tasks[i].threadSlot = firstThreadSlot + i;
+	}
+
+	remainingDependencies = std::make_unique<std::atomic<int>[]>(tasks.size());
+	isGraphDirty = false;
+
+	Logger::info("Scheduler graph built with " + std::to_string(tasks.size()) + " systems and " + std::to_string(numDependencies) + " dependencies");
+}
+
+void Scheduler::update() {
+	if (isGraphDirty) {
+		buildGraph();
+	}
+
+	JobCounter counter;
+	for (size_t i = 0; i < tasks.size(); i++) {
+		remainingDependencies[i].store(tasks[i].numDependencies, std::memory_order_relaxed);
+	}
+
+	for (size_t i = 0; i < tasks.size(); i++) {
+		if (tasks[i].numDependencies == 0) {
+			runTask(i, counter);
+		}
+	}
+
+	// A dependent is queued before the job finishing its last dependency, so the
+	// counter only reaches zero once every system ran
+	jobSystem.wait(counter);
+}
+
+void Scheduler::runTask(int taskIndex, JobCounter& counter) {
+	jobSystem.run([this, taskIndex, &counter]() {
+		const Task& task = tasks[taskIndex];
+		{
+			ThreadSlotScope threadSlotScope(task.threadSlot);
+			task.update();
+		}
+
+		for (int dependent: task.dependents) {
+			if (remainingDependencies[dependent].fetch_sub(1) == 1) {
+				runTask(dependent, counter);
+			}
+		}
+	}, &counter);
+}
@@ -0,0 +1,61 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "../ECS/ECS.h"
+#include "../JobSystem/JobSystem.h"
+
+// Runs system updates as jobs. Systems are added in the order they would run
+// serially, and a system only waits for the earlier systems whose declared
+// component reads and writes conflict with its own, so independent systems
+// run at the same time while conflicting ones keep their order.
+//
+// Every system records its commands and queued events into a thread slot of
+// its own, reserved in the order the systems were added, so they are applied
+// and dispatched in that order whichever worker ran the system. The chunks of
+// a parallelEach still record into the slot of the thread running them.
+class Scheduler {
+
+private:
+	struct Task {
+		System* system;
+		std::function<void()> update;
+		std::vector<int> dependents;
+		int numDependencies = 0;
+		int threadSlot = -1;
+	};
+
+	JobSystem& jobSystem;
+
+	std::vector<Task> tasks;
+	bool isGraphDirty = false;
+
+	// Slots reserved for the tasks, one each
+	int firstThreadSlot = 0;
+	int numThreadSlots = 0;
+
+	// Per frame state of the graph
+	std::unique_ptr<std::atomic<int>[]> remainingDependencies;
+
+	void buildGraph();
+	void runTask(int taskIndex, JobCounter& counter);
+
+public:
+	Scheduler(JobSystem& jobSystem);
+	~Scheduler();
+
+	Scheduler(const Scheduler&) = delete;
+	Scheduler& operator=(const Scheduler&) = delete;
+
+	void addSystem(System& system, std::function<void()> update);
+
+	// Runs every added system once and returns when all of them finished
+	void update();
+
+};
+
+#endif
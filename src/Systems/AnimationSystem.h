@@ -4,6 +4,7 @@
 #include <SDL2/SDL.h>
 
 #include "../ECS/ECS.h"
+#include "../Clock/Clock.h"
 #include "../Components/AnimationComponent.h"
 #include "../Components/SpriteComponent.h"
 
@@ -13,17 +14,19 @@ public:
 	AnimationSystem() {
 		requireComponent<AnimationComponent>();
 		requireComponent<SpriteComponent>();
+
+		writesComponent<AnimationComponent>();
+		writesComponent<SpriteComponent>();
 	}
 
 	void update() {
-		for (auto entity: getEntities()) {
-			auto& animation = entity.getComponent<AnimationComponent>();
-			auto& sprite = entity.getComponent<SpriteComponent>();
+		const int currentTicks = Clock::getTicks();
 
-			int timePassed = SDL_GetTicks() - animation.startTime;
+		registry->view<AnimationComponent, SpriteComponent>().parallelEach([currentTicks](Entity entity, AnimationComponent& animation, SpriteComponent& sprite) {
+			int timePassed = currentTicks - animation.startTime;
 			animation.currentFrame = (timePassed * animation.frameSpeedRate / 1000) % animation.numFrames;
 			sprite.sourceRect.x = animation.currentFrame * sprite.width;
-		}
+		});
 	}
 
 };
@@ -13,12 +13,13 @@ public:
 	CameraMovementSystem() {
 		requireComponent<CameraFollowComponent>();
 		requireComponent<TransformComponent>();
+
+		readsComponent<CameraFollowComponent>();
+		readsComponent<TransformComponent>();
 	}
 
 	void update(SDL_Rect& camera) {
-		for (auto entity : getEntities()) {
-			auto transform = entity.getComponent<TransformComponent>();
-
+		registry->view<const CameraFollowComponent, const TransformComponent>().each([&](Entity entity, const CameraFollowComponent& cameraFollow, const TransformComponent& transform) {
 			if (transform.position.x + (camera.w / 2) < Game::mapWidth) {
 				camera.x = transform.position.x - (Game::windowWidth / 2);
 			}
@@ -32,7 +33,7 @@ public:
 
 			camera.x = camera.x > camera.w ? camera.w : camera.x;
 			camera.y = camera.y > camera.h ? camera.h : camera.y;
-		}
+		});
 	}
 
 };
@@ -6,46 +6,73 @@
 #include "../EventBus/EventBus.h"
 #include "../Components/TransformComponent.h"
 #include "../Components/BoxColliderComponent.h"
+#include "../Components/RigidBodyComponent.h"
+#include "../Components/SpriteComponent.h"
+#include "../Components/ProjectileComponent.h"
+#include "../Components/HealthComponent.h"
 #include "../Events/CollisionEvent.h"
 
 class CollisionSystem : public System {
 
+private:
+	struct Collider {
+		Entity entity;
+		const TransformComponent* transform;
+		const BoxColliderComponent* boxCollider;
+	};
+
+	// Kept between frames so the list doesn't reallocate every frame
+	std::vector<Collider> colliders;
+
+	// Fewer colliders are tested on the calling thread
+	static constexpr int MIN_ROWS_PER_JOB = 64;
+
 public:
 	CollisionSystem() {
 		requireComponent<TransformComponent>();
 		requireComponent<BoxColliderComponent>();
-	}
-
-	void update(std::unique_ptr<EventBus>& eventBus) {
-		auto entities = getEntities();
-
-		for (auto i = entities.begin(); i != entities.end(); i++) {
-			Entity entity = *i;
 
-			auto entityTransform = entity.getComponent<TransformComponent>();
-			auto entityBoxCollider = entity.getComponent<BoxColliderComponent>();
+		readsComponent<TransformComponent>();
+		readsComponent<BoxColliderComponent>();
 
-			for (auto j = i; j < entities.end(); j++) {
-				Entity otherEntity = *j;
-
-				if (entity == otherEntity) {
-					continue;
-				}
+		// Touched by the collision handlers of the movement and damage systems
+		readsComponent<ProjectileComponent>();
+		writesComponent<RigidBodyComponent>();
+		writesComponent<SpriteComponent>();
+		writesComponent<HealthComponent>();
+	}
 
-				auto otherEntityTransform = otherEntity.getComponent<TransformComponent>();
-				auto otherEntityBoxCollider = otherEntity.getComponent<BoxColliderComponent>();
+	void update(std::unique_ptr<EventBus>& eventBus) {
+		// Gather the colliders once so the pair loop doesn't look them up again
+		colliders.clear();
+		registry->view<const TransformComponent, const BoxColliderComponent>().each([&](Entity entity,
+			const TransformComponent& transform, const BoxColliderComponent& boxCollider) {
+			colliders.push_back(Collider{entity, &transform, &boxCollider});
+		});
 
-				if (checkCollision(entityTransform, entityBoxCollider, 
-					otherEntityTransform, otherEntityBoxCollider)) {
-					Logger::info("Entity id = " + std::to_string(entity.getId()) + " collided with " + std::to_string(otherEntity.getId()));
-					eventBus->emit<CollisionEvent>(entity, otherEntity);
+		// Contacts are only queued here, the handlers get them all at once below.
+		// The queue sorts them, so the split of the rows doesn't change their order.
+		auto testRows = [&](int begin, int end) {
+			for (auto i = colliders.begin() + begin; i != colliders.begin() + end; i++) {
+				for (auto j = i + 1; j != colliders.end(); j++) {
+					if (checkCollision(*i->transform, *i->boxCollider, *j->transform, *j->boxCollider)) {
+						eventBus->enqueue<CollisionEvent>(i->entity, j->entity);
+					}
 				}
 			}
+		};
+
+		if (JobSystem* jobSystem = registry->getJobSystem()) {
+			jobSystem->parallelFor(0, colliders.size(), testRows, MIN_ROWS_PER_JOB);
+		} else {
+			testRows(0, colliders.size());
 		}
+
+		eventBus->dispatch<CollisionEvent>();
 	}
 
-	bool checkCollision(TransformComponent aTransform, BoxColliderComponent aCollider,
-		TransformComponent bTransform, BoxColliderComponent bCollider) {
+	bool checkCollision(const TransformComponent& aTransform, const BoxColliderComponent& aCollider,
+		const TransformComponent& bTransform, const BoxColliderComponent& bCollider) {
 
 		return (
 			(aTransform.position.x + aCollider.offset.x) < (bTransform.position.x + bCollider.offset.x) + bCollider.width  &&
@@ -11,47 +11,60 @@
 
 class DamageSystem : public System {
 
+private:
+	int playerTag;
+	int projectilesGroup;
+	int enemiesGroup;
+
+	EventSubscription collisionSubscription;
+
 public:
 	DamageSystem() {
 		requireComponent<BoxColliderComponent>();
+
+		playerTag = Registry::getTagId("player");
+		projectilesGroup = Registry::getGroupId("projectiles");
+		enemiesGroup = Registry::getGroupId("enemies");
 	}
 
 	void subscribeToEvents(std::unique_ptr<EventBus>& eventBus) {
-		eventBus->subscribeToEvent<CollisionEvent>(this, &DamageSystem::onCollision);
+		collisionSubscription = eventBus->subscribeToBatch<CollisionEvent>(this, &DamageSystem::onCollisions);
+	}
+
+	void onCollisions(EventSpan<CollisionEvent> collisions) {
+		for (auto& collision: collisions) {
+			onCollision(collision);
+		}
 	}
 
-	void onCollision(CollisionEvent& event) {
+	void onCollision(const CollisionEvent& event) {
 		Entity a = event.a;
 		Entity b = event.b;
 
-		if (a.belongsToGroup("projectiles") && b.hasTag("player")) {
+		if (a.belongsToGroup(projectilesGroup) && b.hasTag(playerTag)) {
 			onProjectileHitsPlayer(a, b);
 		}
 
-		if (b.belongsToGroup("projectiles") && a.hasTag("player")) {
+		if (b.belongsToGroup(projectilesGroup) && a.hasTag(playerTag)) {
 			onProjectileHitsPlayer(b, a);
 		}
 
-		if (a.belongsToGroup("projectiles") && b.belongsToGroup("enemies")) {
+		if (a.belongsToGroup(projectilesGroup) && b.belongsToGroup(enemiesGroup)) {
 			onProjectileHitsEnemy(a, b);
 		}
 
-		if (b.belongsToGroup("projectiles") && a.belongsToGroup("enemies")) {
+		if (b.belongsToGroup(projectilesGroup) && a.belongsToGroup(enemiesGroup)) {
 			onProjectileHitsEnemy(b, a);
 		}
 	}
 
 	void onProjectileHitsPlayer(Entity projectile, Entity player) {
-		Logger::info("Player took a damage due to a collision with a projectile");
-
-		auto projectileComponent = projectile.getComponent<ProjectileComponent>();
+		const auto& projectileComponent = projectile.getComponent<const ProjectileComponent>();
 
 		if (!projectileComponent.isFriendly) {
 			auto& health = player.getComponent<HealthComponent>();
 
 			health.healthPercentage -= projectileComponent.hitPercentDamage;
-			Logger::info("Player has been hit in " + std::to_string(projectileComponent.hitPercentDamage) 
-				+ " out of " + std::to_string(health.healthPercentage) + " health percentage");
 
 			if (health.healthPercentage <= 0) {
 				player.kill();
@@ -62,16 +75,12 @@ public:
 	}
 
 	void onProjectileHitsEnemy(Entity projectile, Entity enemy) {
-		Logger::info("Enemy took a damage due to a collision with a projectile");
-
-		auto projectileComponent = projectile.getComponent<ProjectileComponent>();
+		const auto& projectileComponent = projectile.getComponent<const ProjectileComponent>();
 
 		if (projectileComponent.isFriendly) {
 			auto& health = enemy.getComponent<HealthComponent>();
 
 			health.healthPercentage -= projectileComponent.hitPercentDamage;
-			Logger::info("Enemy has been hit in " + std::to_string(projectileComponent.hitPercentDamage) 
-				+ " out of " + std::to_string(health.healthPercentage) + " health percentage");
 
 			if (health.healthPercentage <= 0) {
 				enemy.kill();
@@ -0,0 +1,168 @@
+#ifndef HIERARCHYSYSTEM_H
+#define HIERARCHYSYSTEM_H
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "../ECS/ECS.h"
+#include "../Components/TransformComponent.h"
+#include "../Components/HierarchyComponent.h"
+
+// Writes the world TransformComponent of attached entities, so the rest of the
+// systems read world transforms without knowing about the hierarchy. Entities
+// are updated by depth, parents before their children, and only the ones whose
+// parent transform or attachment was written since the last update are
+// recomputed.
+class HierarchySystem : public System {
+
+private:
+	static constexpr int UNKNOWN_DEPTH = -1;
+	static constexpr uint32_t NO_PARENT = 0xFFFFFFFF;
+
+	// Entities sorted by depth, with the depth and the parent handle of each
+	// entity id when they were sorted
+	std::vector<Entity> sortedEntities;
+	std::vector<int> depthPerEntity;
+	std::vector<uint32_t> parentPerEntity;
+	std::vector<Entity> chain;
+	uint32_t lastUpdateTick = 0;
+
+	bool isInHierarchy(Entity entity) const {
+		return registry->valid(entity) && registry->hasComponent<HierarchyComponent>(entity) &&
+			registry->hasComponent<TransformComponent>(entity);
+	}
+
+	// The order only changes when entities join or leave the system or an
+	// entity is attached to another parent
+	bool hasHierarchyChanged(uint32_t sinceTick) const {
+		if (getMembershipChangeTick() >= sinceTick) {
+			return true;
+		}
+
+		bool hasChanged = false;
+		registry->forEachChangedSince<HierarchyComponent>(sinceTick, [&](Entity entity, const HierarchyComponent& hierarchy) {
+			const int entityId = entity.getId();
+
+			if (entityId < static_cast<int>(parentPerEntity.size()) && parentPerEntity[entityId] != NO_PARENT &&
+				parentPerEntity[entityId] != hierarchy.parent.getHandle()) {
+				hasChanged = true;
+			}
+		});
+
+		return hasChanged;
+	}
+
+	// Walks up to the first entity with a known depth, or to the root, and sets
+	// the depth of the entities on the way. A cycle stops the walk after as many
+	// steps as there are entities.
+	int computeDepth(Entity entity) {
+		chain.clear();
+		Entity current = entity;
+
+		while (depthPerEntity[current.getId()] == UNKNOWN_DEPTH) {
+			chain.push_back(current);
+			const Entity parent = registry->getComponent<const HierarchyComponent>(current).parent;
+
+			// Parents that haven't joined the system yet count as roots
+			if (!isInHierarchy(parent) || parent.getId() >= static_cast<int>(depthPerEntity.size()) ||
+				chain.size() > getEntities().size()) {
+				break;
+			}
+
+			current = parent;
+		}
+
+		int depth = depthPerEntity[current.getId()];
+
+		for (auto link = chain.rbegin(); link != chain.rend(); link++) {
+			depthPerEntity[link->getId()] = ++depth;
+		}
+
+		return depthPerEntity[entity.getId()];
+	}
+
+	void sortEntities() {
+		const auto& entities = getEntities();
+		int maxEntityId = -1;
+
+		for (auto entity: entities) {
+			maxEntityId = std::max(maxEntityId, entity.getId());
+		}
+
+		depthPerEntity.assign(maxEntityId + 1, UNKNOWN_DEPTH);
+		parentPerEntity.assign(maxEntityId + 1, NO_PARENT);
+
+		for (auto entity: entities) {
+			computeDepth(entity);
+			parentPerEntity[entity.getId()] = registry->getComponent<const HierarchyComponent>(entity).parent.getHandle();
+		}
+
+		sortedEntities = entities;
+		std::stable_sort(sortedEntities.begin(), sortedEntities.end(), [&](Entity a, Entity b) {
+			return depthPerEntity[a.getId()] < depthPerEntity[b.getId()];
+		});
+	}
+
+public:
+	HierarchySystem() {
+		requireComponent<TransformComponent>();
+		requireComponent<HierarchyComponent>();
+
+		writesComponent<TransformComponent>();
+		readsComponent<HierarchyComponent>();
+	}
+
+	void update() {
+		const uint32_t sinceTick = lastUpdateTick;
+		lastUpdateTick = registry->getCurrentTick();
+
+		if (hasHierarchyChanged(sinceTick)) {
+			sortEntities();
+		}
+
+		for (auto entity: sortedEntities) {
+			const auto& hierarchy = registry->getComponent<const HierarchyComponent>(entity);
+			const Entity parent = hierarchy.parent;
+
+			// Orphans become free entities at their last world transform. The
+			// removal is deferred, they leave the system at the next update
+			if (!registry->valid(parent) || !registry->hasComponent<TransformComponent>(parent)) {
+				registry->removeComponent<HierarchyComponent>(entity);
+				continue;
+			}
+
+			if (registry->getChangeTick<TransformComponent>(parent) < sinceTick &&
+				registry->getChangeTick<HierarchyComponent>(entity) < sinceTick) {
+				continue;
+			}
+
+			const auto& parentTransform = registry->getComponent<const TransformComponent>(parent);
+			const double radians = glm::radians(parentTransform.rotation);
+			const double cosine = std::cos(radians);
+			const double sine = std::sin(radians);
+			const glm::vec2 offset = hierarchy.localPosition * parentTransform.scale;
+
+			const glm::vec2 position = parentTransform.position + glm::vec2(
+				offset.x * cosine - offset.y * sine,
+				offset.x * sine + offset.y * cosine
+			);
+			const glm::vec2 scale = parentTransform.scale * hierarchy.localScale;
+			const double rotation = parentTransform.rotation + hierarchy.localRotation;
+
+			// Only actual changes are written, so children of a parent that
+			// stopped moving aren't marked as changed again
+			const auto& transform = registry->getComponent<const TransformComponent>(entity);
+			if (transform.position != position || transform.scale != scale || transform.rotation != rotation) {
+				auto& worldTransform = registry->getComponent<TransformComponent>(entity);
+				worldTransform.position = position;
+				worldTransform.scale = scale;
+				worldTransform.rotation = rotation;
+			}
+		}
+	}
+
+};
+
+#endif
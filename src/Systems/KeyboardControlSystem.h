@@ -11,6 +11,9 @@
 
 class KeyboardControlSystem : public System {
 
+private:
+	EventSubscription keyPressedSubscription;
+
 public:
 	KeyboardControlSystem() {
 		requireComponent<SpriteComponent>();
@@ -19,15 +22,17 @@ public:
 	}	
 
 	void subscribeToEvents(std::unique_ptr<EventBus>& eventBus) {
-		eventBus->subscribeToEvent<KeyPressedEvent>(this, &KeyboardControlSystem::onKeyPressed);
+		keyPressedSubscription = eventBus->subscribeToEvent<KeyPressedEvent>(this, &KeyboardControlSystem::onKeyPressed);
 	}
 
 	void onKeyPressed(KeyPressedEvent& event) {
-		for (auto entity: getEntities()) {
-			const auto keyboardControl = entity.getComponent<KeyboardControlledComponent>();
-			auto& rigidbody = entity.getComponent<RigidBodyComponent>();
-			auto& sprite = entity.getComponent<SpriteComponent>();
+		// Other keys would stamp every controlled entity without changing it
+		if (event.symbol != SDLK_UP && event.symbol != SDLK_RIGHT && event.symbol != SDLK_DOWN && event.symbol != SDLK_LEFT) {
+			return;
+		}
 
+		registry->view<const KeyboardControlledComponent, RigidBodyComponent, SpriteComponent>().each([&](Entity entity,
+			const KeyboardControlledComponent& keyboardControl, RigidBodyComponent& rigidbody, SpriteComponent& sprite) {
 			switch(event.symbol) {
 				case SDLK_UP:
 					rigidbody.velocity = keyboardControl.upVelocity;
@@ -46,7 +51,7 @@ public:
 					sprite.sourceRect.y = sprite.height * 3;
 					break;
 			}
-		}
+		});
 	}
 
 	void update() {
@@ -1,66 +1,116 @@
 #ifndef MOVEMENTSYSTEM_H
 #define MOVEMENTSYSTEM_H
 
+#include <optional>
+
 #include "../ECS/ECS.h"
 #include "../EventBus/EventBus.h"
 #include "../Events/CollisionEvent.h"
 #include "../Components/TransformComponent.h"
 #include "../Components/RigidBodyComponent.h"
 #include "../Components/SpriteComponent.h"
+#include "../Components/HierarchyComponent.h"
 #include "../Logger/Logger.h"
 
 class MovementSystem : public System {
 
+private:
+	int playerTag;
+	int enemiesGroup;
+	int obstaclesGroup;
+
+	// Keeps transforms and rigid bodies packed in the same order. Archetypes
+	// already store them side by side, so without it the system uses a view
+	std::optional<OwningGroup<const TransformComponent, const RigidBodyComponent>> movingEntities;
+
+	EventSubscription collisionSubscription;
+
 public:
 	MovementSystem() {
 		requireComponent<TransformComponent>();
 		requireComponent<RigidBodyComponent>();
+
+		writesComponent<TransformComponent>();
+		readsComponent<RigidBodyComponent>();
+		readsComponent<HierarchyComponent>();
+
+		playerTag = Registry::getTagId("player");
+		enemiesGroup = Registry::getGroupId("enemies");
+		obstaclesGroup = Registry::getGroupId("obstacles");
+	}
+
+	// Declared once when the level loads, the group handle stays valid for the
+	// lifetime of the registry
+	void setMovingEntities(OwningGroup<const TransformComponent, const RigidBodyComponent> group) {
+		movingEntities = group;
 	}
 
 	void update(double deltaTime) {
-		for (auto entity: getEntities()) {
-			auto& transform = entity.getComponent<TransformComponent>();
-            const auto rigidbody = entity.getComponent<RigidBodyComponent>();
-
-            transform.position.x += rigidbody.velocity.x * deltaTime;
-            transform.position.y += rigidbody.velocity.y * deltaTime; 
-
-            if (entity.hasTag("player")) {
-            	int paddingLeft = 10;
-            	int paddingRight = 50;
-            	int paddingTop = 10;
-            	int paddingBottom = 50;
-            	transform.position.x = transform.position.x < paddingLeft ? paddingLeft : transform.position.x;
-            	transform.position.x = transform.position.x > Game::mapWidth - paddingRight ? Game::mapWidth - paddingRight : transform.position.x;
-
-				transform.position.y = transform.position.y < paddingTop ? paddingTop : transform.position.y;
-            	transform.position.y = transform.position.y > Game::mapHeight - paddingBottom ? Game::mapHeight - paddingBottom : transform.position.y;
-            }
+		// Transforms are read as const and only written for entities that move,
+		// so resting and attached entities keep their change ticks
+		auto move = [&](Entity entity, const TransformComponent& transform, const RigidBodyComponent& rigidbody) {
+			// The HierarchySystem owns the transform of attached entities
+			if (entity.hasComponent<HierarchyComponent>()) {
+				return;
+			}
+
+			glm::vec2 position = transform.position;
+
+			if (rigidbody.velocity.x != 0 || rigidbody.velocity.y != 0) {
+	            position.x += rigidbody.velocity.x * deltaTime;
+	            position.y += rigidbody.velocity.y * deltaTime;
+
+	            if (entity.hasTag(playerTag)) {
+	            	int paddingLeft = 10;
+	            	int paddingRight = 50;
+	            	int paddingTop = 10;
+	            	int paddingBottom = 50;
+	            	position.x = position.x < paddingLeft ? paddingLeft : position.x;
+	            	position.x = position.x > Game::mapWidth - paddingRight ? Game::mapWidth - paddingRight : position.x;
+
+					position.y = position.y < paddingTop ? paddingTop : position.y;
+	            	position.y = position.y > Game::mapHeight - paddingBottom ? Game::mapHeight - paddingBottom : position.y;
+	            }
+
+	            entity.getComponent<TransformComponent>().position = position;
+			}
 
             bool isEntityOutsideMap = (
-            	transform.position.x < 0 || transform.position.x > Game::mapWidth ||
-            	transform.position.x < 0 || transform.position.x > Game::mapHeight
+            	position.x < 0 || position.x > Game::mapWidth ||
+            	position.x < 0 || position.x > Game::mapHeight
             );
 
-            if (isEntityOutsideMap && !entity.hasTag("player")) {
+            if (isEntityOutsideMap && !entity.hasTag(playerTag)) {
             	entity.kill();
             }
+		};
+
+		if (movingEntities) {
+			movingEntities->parallelEach(move);
+		} else {
+			registry->view<const TransformComponent, const RigidBodyComponent>().parallelEach(move);
 		}
 	}
 
 	void subscribeToEvents(const std::unique_ptr<EventBus>& eventBus) {
-		eventBus->subscribeToEvent<CollisionEvent>(this, &MovementSystem::onCollision);
+		collisionSubscription = eventBus->subscribeToBatch<CollisionEvent>(this, &MovementSystem::onCollisions);
+	}
+
+	void onCollisions(EventSpan<CollisionEvent> collisions) {
+		for (auto& collision: collisions) {
+			onCollision(collision);
+		}
 	}
 
-	void onCollision(CollisionEvent& event) {
+	void onCollision(const CollisionEvent& event) {
 		Entity a = event.a;
 		Entity b = event.b;
 
-		if (a.belongsToGroup("enemies") && b.belongsToGroup("obstacles")) {
+		if (a.belongsToGroup(enemiesGroup) && b.belongsToGroup(obstaclesGroup)) {
 			onEnemyHitsObstacles(a, b);
 		}
 
-		if (b.belongsToGroup("enemies") && a.belongsToGroup("obstacles")) {
+		if (b.belongsToGroup(enemiesGroup) && a.belongsToGroup(obstaclesGroup)) {
 			onEnemyHitsObstacles(b, a);
 		}
 	}
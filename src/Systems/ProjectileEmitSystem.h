@@ -8,6 +8,7 @@
 #include "../EventBus/EventBus.h"
 #include "../Events/KeyPressedEvent.h"
 #include "../ECS/ECS.h"
+#include "../Clock/Clock.h"
 #include "../Components/ProjectileEmitterComponent.h"
 #include "../Components/TransformComponent.h"
 #include "../Components/RigidBodyComponent.h"
@@ -17,86 +18,135 @@
 
 class ProjectileEmitSystem : public System { 
 
+private:
+	// Projectiles due this frame, spawned together from the bullet prefab
+	struct ProjectileSpawn {
+		glm::vec2 position;
+		glm::vec2 velocity;
+		bool isFriendly;
+		int hitPercentDamage;
+		int duration;
+	};
+
+	std::vector<ProjectileSpawn> spawns;
+
+	const Prefab* projectilePrefab = nullptr;
+
+	EventSubscription keyPressedSubscription;
+
+	// The projectiles are spawned through the command buffer, so this can run
+	// from any thread and the new entities show up at the next registry update.
+	// Only the values that differ from the prefab are recorded.
+	void spawnProjectiles(Registry& registry) {
+		if (spawns.empty()) {
+			return;
+		}
+
+		if (!projectilePrefab) {
+			Logger::error("Projectiles emitted without a projectile prefab");
+			return;
+		}
+
+		auto& commands = registry.getCommandBuffer();
+		const PendingEntity firstProjectile = commands.instantiate(*projectilePrefab, spawns.size());
+
+		for (int i = 0; i < static_cast<int>(spawns.size()); i++) {
+			const ProjectileSpawn& spawn = spawns[i];
+			const PendingEntity projectile = {firstProjectile.index + i};
+			commands.addComponent<TransformComponent>(projectile, spawn.position, glm::vec2(1.0, 1.0), 0);
+			commands.addComponent<RigidBodyComponent>(projectile, spawn.velocity);
+			commands.addComponent<ProjectileComponent>(projectile, spawn.isFriendly, spawn.hitPercentDamage, spawn.duration);
+		}
+	}
+
 public:
 	ProjectileEmitSystem() {
 		requireComponent<ProjectileEmitterComponent>();
 		requireComponent<TransformComponent>();
+
+		writesComponent<ProjectileEmitterComponent>();
+		readsComponent<TransformComponent>();
+		readsComponent<SpriteComponent>();
+	}
+
+	// Looked up once when the level loads, emitters spawn copies of it
+	void setProjectilePrefab(const Prefab* prefab) {
+		projectilePrefab = prefab;
 	}
 
 	void subscribeToEvents(std::unique_ptr<EventBus>& eventBus) {
-		eventBus->subscribeToEvent<KeyPressedEvent>(this, &ProjectileEmitSystem::onKeyPressed);
+		keyPressedSubscription = eventBus->subscribeToEvent<KeyPressedEvent>(this, &ProjectileEmitSystem::onKeyPressed);
 	}
 
 	void onKeyPressed(KeyPressedEvent& event) {
-		if (event.symbol == SDLK_SPACE) {
-			Logger::info("Shooting projectiles");
-			for (auto entity : getEntities()) {
-				if (entity.hasComponent<CameraFollowComponent>()) {
-					const auto projectileEmitter = entity.getComponent<ProjectileEmitterComponent>();
-					const auto transform = entity.getComponent<TransformComponent>();
-					const auto rigidbody = entity.getComponent<RigidBodyComponent>();
-
-					glm::vec2 projectilePosition = transform.position;
-					if (entity.hasComponent<SpriteComponent>()) {
-						const auto sprite = entity.getComponent<SpriteComponent>();
-						projectilePosition.x += transform.scale.x * sprite.width / 2;
-						projectilePosition.y += transform.scale.y * sprite.height / 2;
-					}
-
-					glm::vec2 projectileVelocity = projectileEmitter.velocity;
-
-					int directionX = 0;
-					int directionY = 0;
-
-					if (rigidbody.velocity.x > 0) directionX = +1;
-					if (rigidbody.velocity.x < 0) directionX = -1;
-					if (rigidbody.velocity.y > 0) directionY = +1;
-					if (rigidbody.velocity.y < 0) directionY = -1;
-
-					projectileVelocity.x = projectileEmitter.velocity.x * directionX;
-					projectileVelocity.y = projectileEmitter.velocity.y * directionY;
-
-					Entity projectile = entity.registry->createEntity();
-					projectile.group("projectiles");
-					projectile.addComponent<TransformComponent>(projectilePosition, glm::vec2(1.0, 1.0), 0);
-					projectile.addComponent<RigidBodyComponent>(projectileVelocity);
-					projectile.addComponent<SpriteComponent>("bullet-image", 4, 4, 4);
-					projectile.addComponent<BoxColliderComponent>(4, 4);
-					projectile.addComponent<ProjectileComponent>(projectileEmitter.isFriendly, projectileEmitter.hitPercentDamage, projectileEmitter.duration);
-				}
+		if (event.symbol != SDLK_SPACE) {
+			return;
+		}
+
+		Logger::info("Shooting projectiles");
+		spawns.clear();
+
+		for (auto entity : getEntities()) {
+			if (!entity.hasComponent<CameraFollowComponent>()) {
+				continue;
 			}
+
+			const auto& projectileEmitter = entity.getComponent<const ProjectileEmitterComponent>();
+			const auto& transform = entity.getComponent<const TransformComponent>();
+			const auto& rigidbody = entity.getComponent<const RigidBodyComponent>();
+
+			glm::vec2 projectilePosition = transform.position;
+			if (entity.hasComponent<SpriteComponent>()) {
+				const auto& sprite = entity.getComponent<const SpriteComponent>();
+				projectilePosition.x += transform.scale.x * sprite.width / 2;
+				projectilePosition.y += transform.scale.y * sprite.height / 2;
+			}
+
+			int directionX = 0;
+			int directionY = 0;
+
+			if (rigidbody.velocity.x > 0) directionX = +1;
+			if (rigidbody.velocity.x < 0) directionX = -1;
+			if (rigidbody.velocity.y > 0) directionY = +1;
+			if (rigidbody.velocity.y < 0) directionY = -1;
+
+			glm::vec2 projectileVelocity;
+			projectileVelocity.x = projectileEmitter.velocity.x * directionX;
+			projectileVelocity.y = projectileEmitter.velocity.y * directionY;
+
+			spawns.push_back({projectilePosition, projectileVelocity,
+				projectileEmitter.isFriendly, projectileEmitter.hitPercentDamage, projectileEmitter.duration});
 		}
+
+		spawnProjectiles(*registry);
 	}
 
 	void update(std::unique_ptr<Registry>& registry) {
-		for (auto entity: getEntities()) {
-			auto& projectileEmitter = entity.getComponent<ProjectileEmitterComponent>();
-			const auto transform = entity.getComponent<TransformComponent>();
+		spawns.clear();
 
+		// Emitters are only written when they fire, so the others keep their change tick
+		registry->view<const ProjectileEmitterComponent, const TransformComponent>().each([&](Entity entity,
+			const ProjectileEmitterComponent& projectileEmitter, const TransformComponent& transform) {
 			if (projectileEmitter.repeatFrequency == 0) {
-				continue;
+				return;
 			}
 
-			if (SDL_GetTicks() - projectileEmitter.lastEmissionTime > projectileEmitter.repeatFrequency) {
-				Entity projectile = registry->createEntity();
-				projectile.group("projectiles");
-
+			if (Clock::getTicks() - projectileEmitter.lastEmissionTime > projectileEmitter.repeatFrequency) {
 				glm::vec2 projectilePosition = transform.position;
 
 				if (entity.hasComponent<SpriteComponent>()) {
-					const auto sprite = entity.getComponent<SpriteComponent>();
+					const auto& sprite = entity.getComponent<const SpriteComponent>();
 					projectilePosition.x += transform.scale.x * sprite.width / 2;
 					projectilePosition.y += transform.scale.y * sprite.height / 2;
 				}
 
-				projectile.addComponent<TransformComponent>(projectilePosition, glm::vec2(1.0, 1.0), 0);
-				projectile.addComponent<RigidBodyComponent>(projectileEmitter.velocity);
-				projectile.addComponent<SpriteComponent>("bullet-image", 4, 4, 4);
-				projectile.addComponent<BoxColliderComponent>(4, 4);
-				projectile.addComponent<ProjectileComponent>(projectileEmitter.isFriendly, projectileEmitter.hitPercentDamage, projectileEmitter.duration);
-				projectileEmitter.lastEmissionTime = SDL_GetTicks();
+				spawns.push_back({projectilePosition, projectileEmitter.velocity,
+					projectileEmitter.isFriendly, projectileEmitter.hitPercentDamage, projectileEmitter.duration});
+				entity.getComponent<ProjectileEmitterComponent>().lastEmissionTime = Clock::getTicks();
 			}
-		}
+		});
+
+		spawnProjectiles(*registry);
 	}
 
 };
@@ -4,6 +4,7 @@
 #include <SDL2/SDL.h>
 
 #include "../ECS/ECS.h"
+#include "../Clock/Clock.h"
 #include "../Components/ProjectileComponent.h"
 
 class ProjectileLifecycleSystem : public System {
@@ -11,16 +12,16 @@ class ProjectileLifecycleSystem : public System {
 public:
 	ProjectileLifecycleSystem() {
 		requireComponent<ProjectileComponent>();
+
+		readsComponent<ProjectileComponent>();
 	}
 
 	void update() {
-		for (auto entity : getEntities()) {
-			const auto projectile = entity.getComponent<ProjectileComponent>();
-
-			if (SDL_GetTicks() - projectile.startTime > projectile.duration) {
+		registry->view<const ProjectileComponent>().each([](Entity entity, const ProjectileComponent& projectile) {
+			if (Clock::getTicks() - projectile.startTime > projectile.duration) {
 				entity.kill();
 			}
-		}
+		});
 	}
 
 };
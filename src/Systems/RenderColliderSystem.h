@@ -16,10 +16,7 @@ public:
 	}
 
 	void update(SDL_Renderer* renderer, SDL_Rect& camera) {
-		for (auto entity: getEntities()) {
-			const auto transform = entity.getComponent<TransformComponent>();
-			const auto collider = entity.getComponent<BoxColliderComponent>();
-
+		registry->view<const TransformComponent, const BoxColliderComponent>().each([&](Entity entity, const TransformComponent& transform, const BoxColliderComponent& collider) {
 			SDL_Rect colliderRect = {
 				static_cast<int>(transform.position.x + collider.offset.x - camera.x),
                 static_cast<int>(transform.position.y + collider.offset.y - camera.y),
@@ -29,7 +26,7 @@ public:
 
 			SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
 			SDL_RenderDrawRect(renderer, &colliderRect);
-		}
+		});
 	}
 
 };
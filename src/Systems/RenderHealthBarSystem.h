@@ -21,11 +21,8 @@ public:
 	void update(SDL_Renderer* renderer, std::unique_ptr<AssetStore>& assetStore,
 		const SDL_Rect& camera) {
 
-		for (auto entity: getEntities()) {
-			const auto transform = entity.getComponent<TransformComponent>();
-			const auto sprite = entity.getComponent<SpriteComponent>();
-			const auto health = entity.getComponent<HealthComponent>();
-
+		registry->view<const TransformComponent, const SpriteComponent, const HealthComponent>().each([&](Entity entity,
+			const TransformComponent& transform, const SpriteComponent& sprite, const HealthComponent& health) {
 			SDL_Color healthBarColor = {255, 255, 255};
 
 			if (health.healthPercentage >= 0 && health.healthPercentage < 40) {
@@ -84,7 +81,7 @@ public:
 
 			SDL_RenderCopy(renderer, texture, NULL, &destinationRect);
 			SDL_DestroyTexture(texture);
-		}
+		});
 	}
 
 };
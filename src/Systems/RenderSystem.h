@@ -12,6 +12,60 @@
 
 class RenderSystem : public System {
 
+private:
+	struct RenderableEntity {
+		Entity entity;
+		int zIndex;
+	};
+
+	static constexpr int NOT_RENDERED = -2147483647 - 1;
+
+	// Entities sorted by zIndex. The order is kept between frames and only
+	// rebuilt when entities join or leave the system or a sprite written since
+	// the last frame has a different zIndex
+	std::vector<RenderableEntity> sortedEntities;
+	std::vector<int> zIndexPerEntity;
+	uint32_t lastUpdateTick = 0;
+
+	bool hasSortOrderChanged(uint32_t sinceTick) const {
+		if (getMembershipChangeTick() >= sinceTick) {
+			return true;
+		}
+
+		bool hasChanged = false;
+		registry->forEachChangedSince<SpriteComponent>(sinceTick, [&](Entity entity, const SpriteComponent& sprite) {
+			const int entityId = entity.getId();
+
+			if (entityId < static_cast<int>(zIndexPerEntity.size()) && zIndexPerEntity[entityId] != NOT_RENDERED &&
+				zIndexPerEntity[entityId] != sprite.zIndex) {
+				hasChanged = true;
+			}
+		});
+
+		return hasChanged;
+	}
+
+	void sortEntities() {
+		sortedEntities.clear();
+		std::fill(zIndexPerEntity.begin(), zIndexPerEntity.end(), NOT_RENDERED);
+
+		for (auto entity: getEntities()) {
+			const int entityId = entity.getId();
+			const int zIndex = registry->getComponent<const SpriteComponent>(entity).zIndex;
+
+			if (entityId >= static_cast<int>(zIndexPerEntity.size())) {
+				zIndexPerEntity.resize(entityId + 1, NOT_RENDERED);
+			}
+
+			zIndexPerEntity[entityId] = zIndex;
+			sortedEntities.push_back(RenderableEntity{entity, zIndex});
+		}
+
+		std::stable_sort(sortedEntities.begin(), sortedEntities.end(), [](const RenderableEntity& a, const RenderableEntity& b) {
+			return a.zIndex < b.zIndex;
+		});
+	}
+
 public:
 	RenderSystem() {
 		requireComponent<TransformComponent>();
@@ -19,20 +73,17 @@ public:
 	}
 
 	void update(SDL_Renderer* renderer, std::unique_ptr<AssetStore>& assetStore, SDL_Rect& camera) {
-		struct RenderableEntity {
-			TransformComponent transformComponent;
-			SpriteComponent spriteComponent;
-		};
+		const uint32_t sinceTick = lastUpdateTick;
+		lastUpdateTick = registry->getCurrentTick();
 
-		std::vector<RenderableEntity> renderableEntities; 
-		for (auto entity: getEntities()) {
-			RenderableEntity renderableEntity;
-
-			auto transform = entity.getComponent<TransformComponent>();
-			auto sprite = entity.getComponent<SpriteComponent>();
+		if (hasSortOrderChanged(sinceTick)) {
+			sortEntities();
+		}
 
-			renderableEntity.transformComponent = transform;
-			renderableEntity.spriteComponent = sprite;
+		// Rendering only reads, the const components aren't marked as changed
+		for (const auto& renderableEntity: sortedEntities) {
+			const auto& transform = registry->getComponent<const TransformComponent>(renderableEntity.entity);
+			const auto& sprite = registry->getComponent<const SpriteComponent>(renderableEntity.entity);
 
 			bool isEntityOutsideCameraView = (
 				transform.position.x + (transform.scale.x * sprite.width) < camera.x ||
@@ -40,22 +91,11 @@ public:
 				transform.position.y + (transform.scale.y * sprite.height) < camera.y ||
 				transform.position.y > camera.y + camera.h
 			);
-			
+
 			if (isEntityOutsideCameraView && !sprite.isFixed) {
 				continue;
 			}
 
-			renderableEntities.emplace_back(renderableEntity);
-		}
-
-		std::sort(renderableEntities.begin(), renderableEntities.end(), [](const RenderableEntity& a, const RenderableEntity& b) {
-			return a.spriteComponent.zIndex < b.spriteComponent.zIndex;
-		});
-
-		for (auto entity: renderableEntities) {
-			const auto transform = entity.transformComponent;
-			const auto sprite = entity.spriteComponent;
-
 			SDL_Texture* texture = assetStore->getTexture(sprite.assetId);
 
 			SDL_Rect source = sprite.sourceRect;
@@ -83,4 +123,4 @@ public:
 
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -15,9 +15,7 @@ public:
 
 	void update(SDL_Renderer* renderer, std::unique_ptr<AssetStore>& assetStore,
 		const SDL_Rect& camera) {
-		for (auto entity: getEntities()) {
-			const auto textLabelComponent = entity.getComponent<TextLabelComponent>();
-
+		registry->view<const TextLabelComponent>().each([&](Entity entity, const TextLabelComponent& textLabelComponent) {
 			TTF_Font* font = assetStore->getFont(textLabelComponent.assetId);
 
 			SDL_Surface* surface = TTF_RenderText_Blended(
@@ -43,7 +41,7 @@ public:
 
 			SDL_RenderCopy(renderer, texture, NULL, &destinationRect);
 			SDL_DestroyTexture(texture);
-		}
+		});
 	}
 
 };
@@ -0,0 +1,127 @@
+// Simulates frames whose systems spawn, move and kill entities through the
+// command buffers, restores an earlier frame from the rollback buffer and
+// simulates the same frames again, which has to end in the same state.
+//
+// make test
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <tuple>
+
+#include "../src/ECS/ECS.h"
+
+// Entities outlive the rewound frames, so a stale spawn is still alive at the end
+static const int MAX_AGE = 10;
+
+struct Position {
+	static constexpr const char* SNAPSHOT_NAME = "Position";
+	static constexpr bool SNAPSHOT_AS_BYTES = true;
+
+	int x = 0;
+	int age = 0;
+
+	Position(int x = 0): x(x) {}
+};
+
+class WorldSystem : public System {
+
+public:
+	WorldSystem() {
+		requireComponent<Position>();
+	}
+
+	// Everything goes through the command buffer, as systems running on the
+	// job system do, so the changes of a frame are only applied by the
+	// registry update of the next one
+	void update(int frame) {
+		auto& commands = registry->getCommandBuffer();
+
+		for (auto entity: getEntities()) {
+			auto& position = registry->getComponent<Position>(entity);
+			position.x += 1 + frame % 3;
+			position.age++;
+
+			if (position.age > MAX_AGE) {
+				commands.killEntity(entity);
+			}
+		}
+
+		const PendingEntity spawned = commands.createEntity();
+		commands.addComponent<Position>(spawned, frame * 10);
+	}
+
+};
+
+static const int NUM_FRAMES = 30;
+static const int REWOUND_FRAMES = 8;
+
+static int numFailures = 0;
+
+static void check(bool condition, const char* message) {
+	if (!condition) {
+		printf("FAILED: %s\n", message);
+		numFailures++;
+	}
+}
+
+// Handles and positions of the live entities, in handle order
+static std::vector<std::tuple<uint32_t, int, int>> getState(Registry& registry) {
+	std::vector<std::tuple<uint32_t, int, int>> state;
+	for (auto entity: registry.getSystem<WorldSystem>().getEntities()) {
+		const auto& position = registry.getComponent<const Position>(entity);
+		state.emplace_back(entity.getHandle(), position.x, position.age);
+	}
+	std::sort(state.begin(), state.end());
+
+	return state;
+}
+
+// Saves the frame once the commands of the previous one are applied, then runs
+// its systems, as Game::simulateFrame does
+static void simulateFrame(Registry& registry, RollbackBuffer& rollbackBuffer, int frame) {
+	registry.update();
+	check(rollbackBuffer.save(registry, frame), "frame saved");
+	registry.getSystem<WorldSystem>().update(frame);
+}
+
+int main() {
+	// The registry logs every created and killed entity
+	std::cout.setstate(std::ios::failbit);
+
+	Registry registry;
+	registry.addSystem<WorldSystem>();
+	RollbackBuffer rollbackBuffer(16);
+
+	for (int frame = 0; frame < NUM_FRAMES; frame++) {
+		simulateFrame(registry, rollbackBuffer, frame);
+	}
+
+	// The commands of the last frame are still pending, applying them ends it
+	registry.update();
+	const auto expectedState = getState(registry);
+
+	// Simulate the last frame again without applying it, so kills and spawns
+	// are pending when the rollback happens
+	const int restoredFrame = NUM_FRAMES - REWOUND_FRAMES;
+	registry.getSystem<WorldSystem>().update(NUM_FRAMES);
+
+	check(rollbackBuffer.restore(registry, restoredFrame), "frame restored");
+	check(!rollbackBuffer.hasFrame(restoredFrame + 1), "later frames dropped");
+
+	registry.getSystem<WorldSystem>().update(restoredFrame);
+	for (int frame = restoredFrame + 1; frame < NUM_FRAMES; frame++) {
+		simulateFrame(registry, rollbackBuffer, frame);
+	}
+	registry.update();
+
+	check(!expectedState.empty(), "entities alive at the end");
+	check(getState(registry) == expectedState, "re-simulated frames end in the same state");
+
+	// A frame that was dropped can't be restored
+	check(!rollbackBuffer.restore(registry, NUM_FRAMES), "dropped frame not restored");
+
+	std::cout.clear();
+	printf(numFailures == 0 ? "RollbackTest passed\n" : "RollbackTest failed\n");
+	return numFailures == 0 ? 0 : 1;
+}